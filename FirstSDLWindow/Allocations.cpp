@@ -0,0 +1,137 @@
+#include "Allocations.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+struct Counters {
+	std::atomic<uint64_t> allocations{ 0 };
+	std::atomic<uint64_t> bytes{ 0 };
+	std::atomic<int64_t> live{ 0 };
+	std::atomic<int64_t> peak{ 0 };
+};
+
+// Constant initialized, so they are ready before any static constructor allocates
+Counters counters[ALLOCATION_SUBSYSTEMS];
+std::atomic<int64_t> totalLive{ 0 };
+std::atomic<int64_t> totalPeak{ 0 };
+thread_local AllocationSubsystem currentSubsystem = ALLOCATION_OTHER;
+
+struct Header {				// Right in front of every block
+	uint64_t size;
+	uint32_t subsystem;
+	uint32_t offset;		// From what malloc returned to the block
+};
+static_assert(sizeof(Header) == 16, "Blocks have to stay aligned to 16 bytes behind the header");
+
+void raisePeak(std::atomic<int64_t>& peak, int64_t value) {
+	int64_t seen = peak.load(std::memory_order_relaxed);
+	while (value > seen && !peak.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+}
+
+void* allocate(size_t size, size_t alignment) {	// NULL if malloc fails, alignments up to 16 come free with the header
+	size_t padding = sizeof(Header) + ((alignment > sizeof(Header)) ? alignment : 0);
+	unsigned char* memory = static_cast<unsigned char*>(std::malloc(size + padding));
+	if (memory == NULL) return NULL;
+	uintptr_t start = reinterpret_cast<uintptr_t>(memory) + sizeof(Header);
+	if (alignment > sizeof(Header)) start = (start + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+	unsigned char* block = reinterpret_cast<unsigned char*>(start);
+
+	Header* header = reinterpret_cast<Header*>(block) - 1;
+	header->size = size;
+	header->subsystem = currentSubsystem;
+	header->offset = static_cast<uint32_t>(block - memory);
+	Counters& counter = counters[currentSubsystem];
+	counter.allocations.fetch_add(1, std::memory_order_relaxed);
+	counter.bytes.fetch_add(size, std::memory_order_relaxed);
+	raisePeak(counter.peak, counter.live.fetch_add((int64_t)size, std::memory_order_relaxed) + (int64_t)size);
+	raisePeak(totalPeak, totalLive.fetch_add((int64_t)size, std::memory_order_relaxed) + (int64_t)size);
+	return block;
+}
+
+void* allocateOrThrow(size_t size, size_t alignment) {
+	void* block = allocate(size, alignment);
+	if (block == NULL) throw std::bad_alloc();
+	return block;
+}
+
+void release(void* block) {
+	if (block == NULL) return;
+	const Header* header = static_cast<const Header*>(block) - 1;
+	counters[header->subsystem].live.fetch_sub((int64_t)header->size, std::memory_order_relaxed);
+	totalLive.fetch_sub((int64_t)header->size, std::memory_order_relaxed);
+	std::free(static_cast<unsigned char*>(block) - header->offset);
+}
+
+}
+
+AllocationCounters allocationCounters(AllocationSubsystem subsystem) {
+	const Counters& counter = counters[subsystem];
+	AllocationCounters result;
+	result.allocations = counter.allocations.load(std::memory_order_relaxed);
+	result.bytes = counter.bytes.load(std::memory_order_relaxed);
+	result.live = counter.live.load(std::memory_order_relaxed);
+	result.peak = counter.peak.load(std::memory_order_relaxed);
+	return result;
+}
+
+AllocationCounters allocationTotals() {
+	AllocationCounters result;
+	for (int i = 0; i < ALLOCATION_SUBSYSTEMS; i++) {
+		result.allocations += counters[i].allocations.load(std::memory_order_relaxed);
+		result.bytes += counters[i].bytes.load(std::memory_order_relaxed);
+	}
+	result.live = totalLive.load(std::memory_order_relaxed);
+	result.peak = totalPeak.load(std::memory_order_relaxed);
+	return result;
+}
+
+void resetAllocationPeaks() {
+	for (int i = 0; i < ALLOCATION_SUBSYSTEMS; i++) {
+		counters[i].peak.store(counters[i].live.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	}
+	totalPeak.store(totalLive.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+const char* allocationSubsystemName(AllocationSubsystem subsystem) {
+	static const char* names[ALLOCATION_SUBSYSTEMS] = { "other", "spawning", "collision", "integration", "rendering", "snapshots", "replays", "capture" };
+	return names[subsystem];
+}
+
+AllocationSubsystem currentAllocationSubsystem() {
+	return currentSubsystem;
+}
+
+AllocationScope::AllocationScope(AllocationSubsystem subsystem) {
+	previous = currentSubsystem;
+	currentSubsystem = subsystem;
+}
+
+AllocationScope::~AllocationScope() {
+	currentSubsystem = previous;
+}
+
+// The replaced global allocation functions, every form forwards to allocate and release
+void* operator new(size_t size) { return allocateOrThrow(size, 0); }
+void* operator new[](size_t size) { return allocateOrThrow(size, 0); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return allocate(size, 0); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return allocate(size, 0); }
+void operator delete(void* block) noexcept { release(block); }
+void operator delete[](void* block) noexcept { release(block); }
+void operator delete(void* block, size_t) noexcept { release(block); }
+void operator delete[](void* block, size_t) noexcept { release(block); }
+void operator delete(void* block, const std::nothrow_t&) noexcept { release(block); }
+void operator delete[](void* block, const std::nothrow_t&) noexcept { release(block); }
+#ifdef __cpp_aligned_new
+void* operator new(size_t size, std::align_val_t alignment) { return allocateOrThrow(size, (size_t)alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return allocateOrThrow(size, (size_t)alignment); }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return allocate(size, (size_t)alignment); }
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return allocate(size, (size_t)alignment); }
+void operator delete(void* block, std::align_val_t) noexcept { release(block); }
+void operator delete[](void* block, std::align_val_t) noexcept { release(block); }
+void operator delete(void* block, size_t, std::align_val_t) noexcept { release(block); }
+void operator delete[](void* block, size_t, std::align_val_t) noexcept { release(block); }
+void operator delete(void* block, std::align_val_t, const std::nothrow_t&) noexcept { release(block); }
+void operator delete[](void* block, std::align_val_t, const std::nothrow_t&) noexcept { release(block); }
+#endif
@@ -0,0 +1,47 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Allocation accounting
+//	The global operator new and delete are replaced (in Allocations.cpp) to count every allocation against the subsystem that
+//	was running on that thread when it was made, see AllocationScope. Every block carries a 16 byte header with its size and
+//	subsystem, so a free is counted against whoever allocated the block, whichever thread or subsystem frees it.
+//	Counters are relaxed atomics, so they are cheap and only exact once the threads involved have synchronized.
+
+enum AllocationSubsystem {
+	ALLOCATION_OTHER,			// Anything outside a scope
+	ALLOCATION_SPAWNING,		// Applying spawns and despawns, and reordering storage
+	ALLOCATION_COLLISION,		// Broadphase, narrowphase and response
+	ALLOCATION_INTEGRATION,		// Moving objects
+	ALLOCATION_RENDERING,		// Filling and drawing render states
+	ALLOCATION_SNAPSHOTS,
+	ALLOCATION_REPLAYS,
+	ALLOCATION_CAPTURE,
+	ALLOCATION_SUBSYSTEMS
+};
+
+struct AllocationCounters {
+	uint64_t allocations = 0;	// Calls to operator new
+	uint64_t bytes = 0;			// Bytes asked for
+	int64_t live = 0;			// Bytes allocated and not freed yet
+	int64_t peak = 0;			// Most bytes live at once since the last resetAllocationPeaks
+};
+
+AllocationCounters allocationCounters(AllocationSubsystem subsystem);	// Since the program started
+AllocationCounters allocationTotals();			// Over every subsystem, peak is the peak of the sum
+void resetAllocationPeaks();					// Peaks start over from what is live now
+const char* allocationSubsystemName(AllocationSubsystem subsystem);
+
+AllocationSubsystem currentAllocationSubsystem();	// Of the calling thread
+
+// Counts the calling thread's allocations against subsystem until it goes out of scope, scopes nest
+class AllocationScope {
+public:
+	explicit AllocationScope(AllocationSubsystem subsystem);
+	~AllocationScope();
+	AllocationScope(const AllocationScope&) = delete;
+	AllocationScope& operator= (const AllocationScope&) = delete;
+
+private:
+	AllocationSubsystem previous;
+};
@@ -0,0 +1,205 @@
+#include "BatchRenderer.h"
+#include <cmath>
+#include <algorithm>
+
+static const float RING_WIDTH = 1.5f;		// A ring exactly one pixel wide misses pixels where it crosses them diagonally
+static const int MIN_SEGMENTS = 8;
+static const int MAX_SEGMENTS = 64;
+static const float SEGMENT_LENGTH = 3.0f;	// Pixels of outline per ring segment, small circles still look round
+static const size_t MAX_IDLE_BUCKETS = 64;	// Past this many buckets the ones left empty after a flush are dropped
+
+static uint32_t packColor(const Color& color) {
+	return color.r | (color.g << 8) | (color.b << 16) | ((uint32_t)color.a << 24);
+}
+
+void BatchRenderer::point(int x, int y, const Color& color) {
+	SDL_Point point = { x, y };
+	bucketFor(color).points.push_back(point);
+}
+
+void BatchRenderer::rect(const SDL_Rect& rect, const Color& color) {
+	bucketFor(color).rects.push_back(rect);
+}
+
+void BatchRenderer::circle(float x, float y, float radius, const Color& color) {
+	Circle circle;
+	circle.x = x;
+	circle.y = y;
+	circle.radius = radius;
+	circle.color.r = color.r;
+	circle.color.g = color.g;
+	circle.color.b = color.b;
+	circle.color.a = color.a;
+	circles.push_back(circle);
+}
+
+void BatchRenderer::fill(const SDL_Rect& rect, const Color& color) {
+	float corners[4][2] = { { 0, 0 }, { 1, 0 }, { 0, 1 }, { 1, 1 } };
+	int first = (int)fillVertices.size();
+	for (auto& corner : corners) {
+		SDL_Vertex vertex;
+		vertex.color.r = color.r;
+		vertex.color.g = color.g;
+		vertex.color.b = color.b;
+		vertex.color.a = color.a;
+		vertex.position.x = (float)rect.x + corner[0] * rect.w;
+		vertex.position.y = (float)rect.y + corner[1] * rect.h;
+		vertex.tex_coord.x = 0;
+		vertex.tex_coord.y = 0;
+		fillVertices.push_back(vertex);
+	}
+	int quad[6] = { first, first + 1, first + 2, first + 2, first + 1, first + 3 };
+	fillIndices.insert(fillIndices.end(), quad, quad + 6);
+}
+
+int BatchRenderer::flush(SDL_Renderer* renderer) {
+	int calls = 0;
+
+	// Fills, untextured geometry takes the draw blend mode, which is put back afterwards
+	if (!fillIndices.empty()) {
+		SDL_BlendMode blendMode;
+		SDL_GetRenderDrawBlendMode(renderer, &blendMode);
+		SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+		SDL_RenderGeometry(renderer, NULL, fillVertices.data(), (int)fillVertices.size(), fillIndices.data(), (int)fillIndices.size());
+		SDL_SetRenderDrawBlendMode(renderer, blendMode);
+		calls++;
+	}
+
+	// Circles, sprites have to be known before the atlas is prepared and the atlas has to be ready before they are drawn
+	SDL_Rect sprite;
+	size_t spriteCircles = 0;
+	for (auto& circle : circles) {
+		if (sprites.find(circle.radius, sprite)) spriteCircles++;
+	}
+	bool useSprites = (spriteCircles > 0) && sprites.prepare(renderer);
+	for (auto& circle : circles) {
+		if (useSprites && sprites.find(circle.radius, sprite)) addSprite(circle, sprite);
+		else addRing(circle);
+	}
+	if (!spriteIndices.empty()) {
+		SDL_RenderGeometry(renderer, sprites.texture(), spriteVertices.data(), (int)spriteVertices.size(), spriteIndices.data(), (int)spriteIndices.size());
+		calls++;
+	}
+	if (!ringIndices.empty()) {
+		SDL_RenderGeometry(renderer, NULL, ringVertices.data(), (int)ringVertices.size(), ringIndices.data(), (int)ringIndices.size());
+		calls++;
+	}
+
+	for (auto& bucket : buckets) {
+		if (bucket.points.empty() && bucket.rects.empty()) continue;
+		SDL_SetRenderDrawColor(renderer, bucket.color & 0xff, (bucket.color >> 8) & 0xff, (bucket.color >> 16) & 0xff, bucket.color >> 24);
+		if (!bucket.rects.empty()) {
+			SDL_RenderDrawRects(renderer, bucket.rects.data(), (int)bucket.rects.size());
+			calls++;
+		}
+		if (!bucket.points.empty()) {
+			SDL_RenderDrawPoints(renderer, bucket.points.data(), (int)bucket.points.size());
+			calls++;
+		}
+	}
+
+	// Clearing keeps the capacity, so a steady scene stops allocating after its first frame
+	circles.clear();
+	spriteVertices.clear();
+	spriteIndices.clear();
+	ringVertices.clear();
+	ringIndices.clear();
+	fillVertices.clear();
+	fillIndices.clear();
+	if (buckets.size() > MAX_IDLE_BUCKETS) {
+		buckets.erase(std::remove_if(buckets.begin(), buckets.end(), [](const Bucket& bucket) {
+			return bucket.points.empty() && bucket.rects.empty();
+		}), buckets.end());
+	}
+	for (auto& bucket : buckets) {
+		bucket.points.clear();
+		bucket.rects.clear();
+	}
+	lastBucket = 0;
+	return calls;
+}
+
+void BatchRenderer::invalidate() {
+	sprites.invalidate();
+}
+
+void BatchRenderer::release() {
+	sprites.release();
+}
+
+void BatchRenderer::addSprite(const Circle& circle, const SDL_Rect& sprite) {
+	// Snapped to whole pixels so every texel lands on exactly one pixel
+	float left = (float)((int)circle.x - sprites.center(sprite));
+	float top = (float)((int)circle.y - sprites.center(sprite));
+	float scale = 1.0f / sprites.size();
+	float corners[4][2] = { { 0, 0 }, { 1, 0 }, { 0, 1 }, { 1, 1 } };
+	int first = (int)spriteVertices.size();
+	for (auto& corner : corners) {
+		SDL_Vertex vertex;
+		vertex.color = circle.color;
+		vertex.position.x = left + corner[0] * sprite.w;
+		vertex.position.y = top + corner[1] * sprite.h;
+		vertex.tex_coord.x = (sprite.x + corner[0] * sprite.w) * scale;
+		vertex.tex_coord.y = (sprite.y + corner[1] * sprite.h) * scale;
+		spriteVertices.push_back(vertex);
+	}
+	int quad[6] = { first, first + 1, first + 2, first + 2, first + 1, first + 3 };
+	spriteIndices.insert(spriteIndices.end(), quad, quad + 6);
+}
+
+void BatchRenderer::addRing(const Circle& circle) {
+	int segments = std::min(std::max((int)std::ceil(2 * 3.14159265f * circle.radius / SEGMENT_LENGTH), MIN_SEGMENTS), MAX_SEGMENTS);
+	const std::vector<SDL_FPoint>& unit = unitCircle(segments);
+	float outer = circle.radius;
+	float inner = std::max(circle.radius - RING_WIDTH, 0.0f);
+
+	// Vertices alternate outer and inner, segment i is the quad between spokes i and i + 1
+	int first = (int)ringVertices.size();
+	for (int i = 0; i < segments; i++) {
+		SDL_Vertex vertex;
+		vertex.color = circle.color;
+		vertex.tex_coord.x = 0;
+		vertex.tex_coord.y = 0;
+		vertex.position.x = circle.x + unit[i].x * outer;
+		vertex.position.y = circle.y + unit[i].y * outer;
+		ringVertices.push_back(vertex);
+		vertex.position.x = circle.x + unit[i].x * inner;
+		vertex.position.y = circle.y + unit[i].y * inner;
+		ringVertices.push_back(vertex);
+	}
+	for (int i = 0; i < segments; i++) {
+		int outerA = first + 2 * i;
+		int innerA = outerA + 1;
+		int outerB = first + 2 * ((i + 1) % segments);
+		int innerB = outerB + 1;
+		int quad[6] = { outerA, innerA, outerB, outerB, innerA, innerB };
+		ringIndices.insert(ringIndices.end(), quad, quad + 6);
+	}
+}
+
+BatchRenderer::Bucket& BatchRenderer::bucketFor(const Color& color) {
+	uint32_t key = packColor(color);
+	if (lastBucket < buckets.size() && buckets[lastBucket].color == key) return buckets[lastBucket];
+	for (size_t i = 0; i < buckets.size(); i++) {	// There are only ever a few colors, a linear search beats hashing
+		if (buckets[i].color != key) continue;
+		lastBucket = i;
+		return buckets[i];
+	}
+	buckets.push_back(Bucket());
+	buckets.back().color = key;
+	lastBucket = buckets.size() - 1;
+	return buckets.back();
+}
+
+const std::vector<SDL_FPoint>& BatchRenderer::unitCircle(int segments) {
+	if ((int)unitCircles.size() <= segments) unitCircles.resize(segments + 1);
+	std::vector<SDL_FPoint>& unit = unitCircles[segments];
+	if (unit.empty()) {
+		for (int i = 0; i < segments; i++) {
+			float angle = 2 * 3.14159265f * i / segments;
+			SDL_FPoint point = { std::cos(angle), std::sin(angle) };
+			unit.push_back(point);
+		}
+	}
+	return unit;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include "Object.h"
+#include "SDL.h"
+#include "SpriteCache.h"
+#include <cstdint>
+#include <vector>
+
+// Collects everything drawn in a frame and submits it in a handful of large draw calls
+//	Circles are textured quads cut from a sprite atlas (see SpriteCache) with the color in every vertex, so all of them go out
+//	in one SDL_RenderGeometry call. Without render targets they fall back to untextured rings of triangles, also one call.
+//	Points and rectangle outlines can't carry a color per vertex, so they are bucketed by color and sent with one
+//	SDL_RenderDrawPoints/SDL_RenderDrawRects call per bucket. Filled rectangles are blended quads, all drawn first in one call. The number of draw calls depends on how many colors are in use,
+//	never on how many objects there are. Every buffer keeps its memory between frames.
+class BatchRenderer {
+public:
+	void point(int x, int y, const Color& color);
+	void rect(const SDL_Rect& rect, const Color& color);
+	void circle(float x, float y, float radius, const Color& color);	// One pixel wide outline
+	void fill(const SDL_Rect& rect, const Color& color);				// Filled and alpha blended, underneath everything else
+	int flush(SDL_Renderer* renderer);		// Draws everything batched since the last flush, returns the number of draw calls it took
+	void invalidate();						// The renderer lost its render targets, sprites are drawn again on the next flush
+	void release();							// Frees the textures, has to happen before the renderer is destroyed
+
+private:
+	struct Bucket {
+		uint32_t color;
+		std::vector<SDL_Point> points;
+		std::vector<SDL_Rect> rects;
+	};
+	struct Circle {
+		float x, y, radius;
+		SDL_Color color;
+	};
+	std::vector<Bucket> buckets;
+	size_t lastBucket = 0;					// Objects mostly come in runs of one color, so the last bucket is checked first
+	std::vector<Circle> circles;
+	SpriteCache sprites;
+	std::vector<SDL_Vertex> spriteVertices, ringVertices, fillVertices;
+	std::vector<int> spriteIndices, ringIndices, fillIndices;
+	std::vector<std::vector<SDL_FPoint>> unitCircles;	// Unit circle points, indexed by segment count
+
+	Bucket& bucketFor(const Color& color);
+	void addSprite(const Circle& circle, const SDL_Rect& sprite);
+	void addRing(const Circle& circle);
+	const std::vector<SDL_FPoint>& unitCircle(int segments);
+};
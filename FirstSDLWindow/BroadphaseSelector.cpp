@@ -0,0 +1,110 @@
+#include "BroadphaseSelector.h"
+#include <algorithm>
+#include <cmath>
+
+static const float COST_SMOOTHING = 0.2f;		// Weight of the newest timing in the learned cost per unit
+static const float SWITCH_MARGIN = 0.75f;		// Another broadphase has to be estimated at most this fraction of the current one
+static const int SWITCH_FRAMES = 30;			// for this many frames in a row
+static const int MIN_FRAMES_IN_KIND = 120;		// and the current one has to have run at least this long
+
+BroadphaseSelector::BroadphaseSelector(float binSize, float width, float height) {
+	this->binSize = std::max(binSize, 1.0f);
+	columns = std::max((int)std::ceil(width / this->binSize), 1);
+	rows = std::max((int)std::ceil(height / this->binSize), 1);
+	bins.assign(columns * rows, 0);
+	strips.assign(columns, 0);
+}
+
+void BroadphaseSelector::reset(BroadphaseKind kind) {
+	this->kind = kind;
+	framesInKind = 0;
+	framesAhead = 0;
+	for (int i = 0; i < BROADPHASE_KINDS; i++) {
+		work[i] = 0;
+		cost[i] = 0;
+		estimates[i] = 0;
+	}
+}
+
+BroadphaseKind BroadphaseSelector::current() const {
+	return kind;
+}
+
+int BroadphaseSelector::update(const std::vector<Object*>& objects, uint32_t frame, float displacement, double collisionMs) {
+	// The pass that just ran is timed against the work estimated for it, except the first one after a switch, which
+	// built its structure from scratch
+	if (framesInKind > 0 && work[kind] > 0) {
+		float unitCost = (float)collisionMs / work[kind];
+		cost[kind] = (cost[kind] == 0) ? unitCost : cost[kind] + COST_SMOOTHING * (unitCost - cost[kind]);
+	}
+	framesInKind++;
+	measure(objects, frame, displacement);
+	for (int i = 0; i < BROADPHASE_KINDS; i++) {
+		estimates[i] = ((cost[i] > 0) ? cost[i] : cost[kind]) * work[i];
+	}
+	if (cost[kind] == 0) return 0;	// Nothing was timed yet
+
+	int best = kind;
+	for (int i = 0; i < BROADPHASE_KINDS; i++) {
+		if (estimates[i] < estimates[best]) best = i;
+	}
+	if (best == kind || estimates[best] > SWITCH_MARGIN * estimates[kind]) {
+		framesAhead = 0;
+		return 0;
+	}
+	framesAhead = (best == ahead) ? framesAhead + 1 : 1;
+	ahead = (BroadphaseKind)best;
+	if (framesAhead < SWITCH_FRAMES || framesInKind < MIN_FRAMES_IN_KIND) return 0;
+	kind = (BroadphaseKind)best;
+	framesInKind = 0;
+	framesAhead = 0;
+	switches++;
+	return 1;
+}
+
+float BroadphaseSelector::estimate(BroadphaseKind kind) const {
+	return estimates[kind];
+}
+
+size_t BroadphaseSelector::getSwitches() const {
+	return switches;
+}
+
+void BroadphaseSelector::measure(const std::vector<Object*>& objects, uint32_t frame, float displacement) {
+	std::fill(bins.begin(), bins.end(), 0);
+	std::fill(strips.begin(), strips.end(), 0);
+	float touching = 0;
+	for (auto object : objects) {
+		int column = std::min(std::max((int)std::floor(object->pos.x / binSize), 0), columns - 1);
+		int row = std::min(std::max((int)std::floor(object->pos.y / binSize), 0), rows - 1);
+		bins[column * rows + row]++;
+		strips[column]++;
+		if (object->lastCollisionFrame == frame) touching++;
+	}
+	float n = (float)objects.size();
+	if (objects.empty()) {
+		for (int i = 0; i < BROADPHASE_KINDS; i++) work[i] = 0;
+		return;
+	}
+
+	// How many objects an object shares its bin and its x strip with on average, the candidates a broadphase has to sort out
+	double crowd = 0, stripCrowd = 0;
+	float occupied = 0;
+	for (int count : bins) {
+		crowd += (double)count * count;
+		if (count > 0) occupied++;
+	}
+	for (int count : strips) {
+		stripCrowd += (double)count * count;
+	}
+	crowd /= n;
+	stripCrowd /= n;
+	float levels = std::log2(n + 1);
+	float moved = std::min(displacement / binSize, 1.0f);	// Part of a bin objects crossed last frame, how much gets resorted and rebinned
+
+	// Touching pairs are resolved whatever the broadphase, so they are in every estimate
+	work[BROADPHASE_BRUTE_FORCE] = n * (n - 1) / 2 + touching;
+	work[BROADPHASE_SWEEP_AND_PRUNE] = n * (1 + moved * (float)stripCrowd) + n * (float)stripCrowd / 4 + touching;	// A box spans about half a strip, pairs are swept from one side
+	work[BROADPHASE_UNIFORM_GRID] = n * (2 + 4 * moved) + n * (float)crowd + occupied + touching;
+	work[BROADPHASE_LINEAR_BVH] = n * 2 * levels + n * (levels + (float)crowd) + touching;	// Sorting and building, then a descent per object
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include "Object.h"
+#include <cstddef>
+#include <vector>
+
+enum BroadphaseKind {
+	BROADPHASE_BRUTE_FORCE,
+	BROADPHASE_SWEEP_AND_PRUNE,
+	BROADPHASE_UNIFORM_GRID,
+	BROADPHASE_LINEAR_BVH,
+	BROADPHASE_KINDS
+};
+
+// Picks the broadphase the scene is cheapest to run with, as the scene changes (see ADAPTIVE_BROADPHASE in Game.h)
+//	Every frame the objects are counted into a coarse histogram, which says how many objects share a neighborhood and an x
+//	strip. From that, the object count, how far objects move and how many touch, each broadphase gets a rough amount of work
+//	(pair tests, sorting, cell visits, tree levels). What that work costs in ms is learned from the collision pass timings
+//	of the broadphase that is running, broadphases that never ran are assumed to cost the same per unit.
+//	A switch needs another broadphase to be estimated clearly cheaper for a number of frames in a row, and the current one to
+//	have run for a while, so two broadphases that cost about the same don't take turns.
+class BroadphaseSelector {
+public:
+	BroadphaseSelector(float binSize = 24, float width = 1920, float height = 1080);	// Histogram bins should be about a grid cell
+	void reset(BroadphaseKind kind);	// Starts over from kind, forgetting the timings
+	BroadphaseKind current() const;
+
+	// Call once a frame before the collision pass, with the time the last one took (which ran with current()).
+	// Returns 1 if current() changed, the caller then has to switch before the pass
+	int update(const std::vector<Object*>& objects, uint32_t frame, float displacement, double collisionMs);
+	float estimate(BroadphaseKind kind) const;	// Estimated collision pass time in ms at the last update
+	size_t getSwitches() const;
+
+private:
+	BroadphaseKind kind = BROADPHASE_SWEEP_AND_PRUNE;
+	float binSize;
+	int columns, rows;					// Objects outside the histogram are counted in its border bins
+	std::vector<int> bins;
+	std::vector<int> strips;			// Per column
+	float work[BROADPHASE_KINDS] = {};	// Model units at the last update
+	float cost[BROADPHASE_KINDS] = {};	// ms per unit, 0 until the broadphase has run
+	float estimates[BROADPHASE_KINDS] = {};
+	int framesInKind = 0;				// Since the last switch
+	int framesAhead = 0;				// Frames in a row the same other broadphase was estimated clearly cheaper
+	BroadphaseKind ahead = BROADPHASE_SWEEP_AND_PRUNE;
+	size_t switches = 0;
+
+	void measure(const std::vector<Object*>& objects, uint32_t frame, float displacement);	// Fills work
+};
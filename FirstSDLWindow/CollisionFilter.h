@@ -0,0 +1,39 @@
+#pragma once
+#include <cstddef>
+
+// Collision layers
+//	An object belongs to the categories in category and only collides with the categories in mask.
+//	Objects that share a nonzero group ignore the masks: a positive group always collides, a negative one never does
+//	(a unit and the projectiles it fired can share a negative group so they never hit each other).
+enum CollisionCategory : unsigned int {
+	CATEGORY_DEFAULT		= 1 << 0,
+	CATEGORY_STATIC			= 1 << 1,
+	CATEGORY_RED_TEAM		= 1 << 2,
+	CATEGORY_BLUE_TEAM		= 1 << 3,
+	CATEGORY_PROJECTILE		= 1 << 4,
+	CATEGORY_ALL			= 0xffffffff
+};
+
+struct CollisionFilter {
+	unsigned int category = CATEGORY_DEFAULT;
+	unsigned int mask = CATEGORY_ALL;
+	int group = 0;
+};
+
+inline int shouldCollide(const CollisionFilter& a, const CollisionFilter& b) {	// Branch free so it can sit in the broadphase inner loops
+	int sameGroup = (a.group == b.group) & (a.group != 0);
+	int groupCollides = (a.group > 0);
+	int masksCollide = ((a.category & b.mask) != 0) & ((b.category & a.mask) != 0);
+	return (sameGroup & groupCollides) | ((sameGroup ^ 1) & masksCollide);
+}
+
+template <typename Pair>
+size_t filterPairs(Pair* pairs, size_t count) {	// Compacts a list of object pairs down to the ones that should collide, returns how many are left
+	size_t kept = 0;
+	for (size_t i = 0; i < count; i++) {	// Every pair is copied and the output index only moves for kept ones, so there is no branch to mispredict
+		int keep = shouldCollide(pairs[i].first->filter, pairs[i].second->filter);
+		pairs[kept] = pairs[i];
+		kept += keep;
+	}
+	return kept;
+}
@@ -0,0 +1,120 @@
+#include "ContactCache.h"
+
+ContactCache::ContactCache() {
+	Entry empty;
+	empty.key = EMPTY_KEY;
+	table.assign(1024, empty);
+	count = 0;
+	transitions = 0;
+}
+
+unsigned long long ContactCache::makeKey(size_t idA, size_t idB) {
+	return ((unsigned long long)idA << 32) | (unsigned long long)(idB & 0xffffffff);
+}
+
+size_t ContactCache::slotFor(unsigned long long key) const {	// Where the key is, or the empty slot it would go in
+	size_t mask = table.size() - 1;
+	unsigned long long hash = key * 0x9E3779B97F4A7C15ull;	// Fibonacci hashing spreads out neighbouring ids
+	size_t slot = (size_t)(hash >> 32) & mask;
+	while (table[slot].key != key && table[slot].key != EMPTY_KEY) {
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+void ContactCache::grow() {
+	std::vector<Entry> old;
+	old.swap(table);
+	Entry empty;
+	empty.key = EMPTY_KEY;
+	table.assign(old.size() * 2, empty);
+	for (auto& entry : old) {
+		if (entry.key != EMPTY_KEY) table[slotFor(entry.key)] = entry;
+	}
+}
+
+void ContactCache::erase(unsigned long long key) {
+	size_t mask = table.size() - 1;
+	size_t hole = slotFor(key);
+	if (table[hole].key == EMPTY_KEY) return;
+	table[hole].key = EMPTY_KEY;
+	count--;
+
+	// Shifting later entries of the probe chain back so lookups never stop early at the hole
+	size_t slot = (hole + 1) & mask;
+	while (table[slot].key != EMPTY_KEY) {
+		size_t home = (size_t)((table[slot].key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+		if (((slot - home) & mask) >= ((slot - hole) & mask)) {	// The hole lies between this entry's home and its slot
+			table[hole] = table[slot];
+			table[slot].key = EMPTY_KEY;
+			hole = slot;
+		}
+		slot = (slot + 1) & mask;
+	}
+}
+
+ContactEvent ContactCache::makeEvent(ContactEventType type, const Entry& entry) const {
+	ContactEvent event;
+	event.type = type;
+	event.idA = (size_t)(entry.key >> 32);
+	event.idB = (size_t)(entry.key & 0xffffffff);
+	event.a = entry.a;
+	event.b = entry.b;
+	return event;
+}
+
+void ContactCache::beginFrame() {
+	eventBuffer.clear();
+	persistBuffer.clear();
+	transitions = 0;
+}
+
+void ContactCache::addContact(const Object& a, const Object& b, size_t frame) {
+	bool swap = b.id < a.id;
+	const Object& first = swap ? b : a;
+	const Object& second = swap ? a : b;
+	unsigned long long key = makeKey(first.id, second.id);
+
+	size_t slot = slotFor(key);
+	Entry& entry = table[slot];
+	if (entry.key == key) {
+		if (entry.lastFrame == frame) return;	// Already reported this frame
+		entry.lastFrame = frame;
+		persistBuffer.push_back(makeEvent(CONTACT_PERSIST, entry));
+		return;
+	}
+
+	entry.key = key;
+	entry.a = first.handle;
+	entry.b = second.handle;
+	entry.lastFrame = frame;
+	eventBuffer.push_back(makeEvent(CONTACT_BEGIN, entry));
+	count++;
+	if (count * 2 > table.size()) grow();	// Keeping the load factor under 1/2 so probe chains stay short
+}
+
+void ContactCache::endFrame(size_t frame) {
+	endedKeys.clear();
+	for (auto& entry : table) {
+		if (entry.key == EMPTY_KEY || entry.lastFrame == frame) continue;
+		eventBuffer.push_back(makeEvent(CONTACT_END, entry));
+		endedKeys.push_back(entry.key);
+	}
+	for (auto key : endedKeys) {	// Erasing after the scan, since erasing moves entries around
+		erase(key);
+	}
+	transitions = eventBuffer.size();
+	eventBuffer.insert(eventBuffer.end(), persistBuffer.begin(), persistBuffer.end());
+}
+
+const std::vector<ContactEvent>& ContactCache::events() const {
+	return eventBuffer;
+}
+
+size_t ContactCache::transitionCount() const {
+	return transitions;
+}
+
+size_t ContactCache::size() const {
+	return count;
+}
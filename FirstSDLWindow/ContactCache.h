@@ -0,0 +1,50 @@
+#pragma once
+#include "Object.h"
+#include <vector>
+
+enum ContactEventType {
+	CONTACT_BEGIN,		// The objects started touching this frame
+	CONTACT_PERSIST,	// The objects were already touching last frame
+	CONTACT_END			// The objects stopped touching (or one of them was despawned)
+};
+
+struct ContactEvent {
+	ContactEventType type;
+	size_t idA, idB;	// idA < idB
+	Handle a, b;		// Handles to the objects, these can be stale for CONTACT_END
+};
+
+// Remembers which pairs of objects touched last frame, so contacts can be reported as begin/persist/end events
+//	Pairs are kept in an open addressing hash table (linear probing) keyed by the ordered id pair.
+//	Events go into one flat buffer per frame: first the transitions (begin, then end), then the persisting contacts,
+//	so code that only cares about transitions can stop reading after transitionCount().
+class ContactCache {
+public:
+	ContactCache();
+	void beginFrame();										// Clears last frame's events
+	void addContact(const Object& a, const Object& b, size_t frame);	// Reports that a and b touch this frame (reporting the same pair twice is fine)
+	void endFrame(size_t frame);							// Ends every contact that wasn't reported this frame and finishes the event buffer
+	const std::vector<ContactEvent>& events() const;
+	size_t transitionCount() const;							// events()[0, transitionCount()) are the begin and end events
+	size_t size() const;									// Number of pairs currently touching
+
+private:
+	static const unsigned long long EMPTY_KEY = ~0ull;
+	struct Entry {
+		unsigned long long key;
+		Handle a, b;
+		size_t lastFrame;
+	};
+	std::vector<Entry> table;		// Capacity is always a power of two
+	size_t count;
+	std::vector<ContactEvent> eventBuffer;
+	std::vector<ContactEvent> persistBuffer;	// Persist events are collected apart and appended after the transitions
+	std::vector<unsigned long long> endedKeys;
+	size_t transitions;
+
+	static unsigned long long makeKey(size_t idA, size_t idB);
+	size_t slotFor(unsigned long long key) const;
+	void grow();
+	void erase(unsigned long long key);
+	ContactEvent makeEvent(ContactEventType type, const Entry& entry) const;
+};
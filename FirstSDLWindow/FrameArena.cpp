@@ -0,0 +1,45 @@
+#include "FrameArena.h"
+#include <algorithm>
+
+FrameArena::FrameArena(size_t initialSize) {
+	Block block;
+	block.memory.reset(new unsigned char[initialSize]);
+	block.size = initialSize;
+	blocks.push_back(std::move(block));
+	offset = 0;
+	usedBytes = 0;
+}
+
+void* FrameArena::allocate(size_t bytes, size_t alignment) {
+	Block* block = &blocks.back();	// Blocks come from new[], so they start aligned for any fundamental type
+	size_t start = (offset + alignment - 1) & ~(alignment - 1);
+	if (start + bytes > block->size) {	// Out of room, this frame continues in a new block
+		Block next;
+		next.size = std::max(block->size * 2, bytes + alignment);
+		next.memory.reset(new unsigned char[next.size]);
+		blocks.push_back(std::move(next));
+		block = &blocks.back();
+		start = 0;
+	}
+	offset = start + bytes;
+	usedBytes += bytes;
+	return block->memory.get() + start;
+}
+
+void FrameArena::reset() {
+	if (blocks.size() > 1) {	// The last frame didn't fit, so replace everything with one block that would have fit it
+		size_t total = 0;
+		for (auto& block : blocks) total += block.size;
+		blocks.clear();
+		Block block;
+		block.memory.reset(new unsigned char[total]);
+		block.size = total;
+		blocks.push_back(std::move(block));
+	}
+	offset = 0;
+	usedBytes = 0;
+}
+
+size_t FrameArena::used() const {
+	return usedBytes;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include <memory>
+
+// Linear allocator for memory that only lives for one frame (pair lists, query results, scratch buffers)
+//	Allocating is a pointer bump and reset() throws everything away at once, nothing is freed individually.
+//	Only trivially destructible types should be put in here since no destructors are ever run.
+class FrameArena {
+public:
+	FrameArena(size_t initialSize = 1 << 20);
+	void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t));
+	template <typename T>
+	T* allocate(size_t count) {
+		return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+	}
+	void reset();					// Frees everything allocated since the last reset
+	size_t used() const;			// Bytes handed out since the last reset
+
+private:
+	struct Block {
+		std::unique_ptr<unsigned char[]> memory;
+		size_t size;
+	};
+	std::vector<Block> blocks;		// After a reset there is only one block, large enough for the busiest frame so far
+	size_t offset;					// Position in blocks.back()
+	size_t usedBytes;
+};
@@ -0,0 +1,241 @@
+#include "FrameEncoder.h"
+#include "Allocations.h"
+#include <algorithm>
+
+static const size_t STORED_BLOCK_SIZE = 65535;	// Largest block deflate can store without compressing
+
+struct CrcTable {
+	uint32_t entries[256];
+	CrcTable() {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t value = i;
+			for (int bit = 0; bit < 8; bit++) value = (value & 1) ? 0xedb88320 ^ (value >> 1) : value >> 1;
+			entries[i] = value;
+		}
+	}
+};
+
+static uint32_t crc32(const unsigned char* data, size_t length, uint32_t crc = 0) {
+	static const CrcTable table;	// Built on first use, safely even with several encoders
+	crc = ~crc;
+	for (size_t i = 0; i < length; i++) crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+static void putBigEndian(std::vector<unsigned char>& out, uint32_t value) {
+	out.push_back((unsigned char)(value >> 24));
+	out.push_back((unsigned char)(value >> 16));
+	out.push_back((unsigned char)(value >> 8));
+	out.push_back((unsigned char)value);
+}
+
+static void beginChunk(std::vector<unsigned char>& out, const char* type, uint32_t length) {
+	putBigEndian(out, length);
+	out.insert(out.end(), type, type + 4);
+}
+
+static void endChunk(std::vector<unsigned char>& out, size_t chunkStart) {	// chunkStart is where the length was written
+	putBigEndian(out, crc32(out.data() + chunkStart + 4, out.size() - chunkStart - 4));
+}
+
+FrameEncoder::~FrameEncoder() {
+	close();
+}
+
+int FrameEncoder::open(const char* path, CaptureFormat format, int width, int height, const RenderPalette& palette) {
+	close();
+	this->format = format;
+	this->path = path;
+	this->palette = palette;
+	canvas.resize(width, height);
+	if (format == CAPTURE_Y4M) {
+		stream = fopen(path, "wb");
+		if (stream == NULL) return 0;
+		if (fprintf(stream, "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 C420jpeg\n", width, height) < 0) {
+			fclose(stream);
+			stream = NULL;
+			return 0;
+		}
+	}
+	freeFrames.clear();
+	queuedFrames.clear();
+	for (auto& frame : frames) {
+		freeFrames.push_back(&frame);
+	}
+	stopping = false;
+	failed = false;
+	dropped = 0;
+	worker = std::thread(&FrameEncoder::run, this);
+	return 1;
+}
+
+RenderState* FrameEncoder::acquireFrame() {
+	std::unique_lock<std::mutex> guard(lock, std::try_to_lock);	// Even a busy lock counts as being behind
+	if (!guard.owns_lock() || freeFrames.empty()) {
+		dropped++;
+		return NULL;
+	}
+	RenderState* frame = freeFrames.back();
+	freeFrames.pop_back();
+	return frame;
+}
+
+void FrameEncoder::submit(RenderState* frame) {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		queuedFrames.push_back(frame);
+	}
+	wake.notify_one();
+}
+
+int FrameEncoder::close() {
+	if (!worker.joinable()) return 1;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_one();
+	worker.join();
+	if (stream != NULL && fclose(stream) != 0) failed = true;
+	stream = NULL;
+	return !failed;
+}
+
+bool FrameEncoder::isOpen() const {
+	return worker.joinable();
+}
+
+size_t FrameEncoder::droppedFrames() const {
+	return dropped;
+}
+
+void FrameEncoder::run() {
+	AllocationScope scope(ALLOCATION_CAPTURE);
+	while (true) {
+		RenderState* frame;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			wake.wait(guard, [this] { return stopping || !queuedFrames.empty(); });
+			if (queuedFrames.empty()) return;	// Stopping, and everything submitted has been written
+			frame = queuedFrames.front();
+			queuedFrames.pop_front();
+		}
+		int written = encode(*frame);
+		std::lock_guard<std::mutex> guard(lock);
+		if (!written) failed = true;
+		freeFrames.push_back(frame);
+	}
+}
+
+int FrameEncoder::encode(const RenderState& frame) {
+	canvas.clear(palette.background);
+	drawFrame(frame, palette, canvas);
+	return (format == CAPTURE_PNG) ? writePNG(frame.frame) : writeY4M();
+}
+
+int FrameEncoder::writePNG(size_t frameNumber) {
+	int width = canvas.width();
+	int height = canvas.height();
+	size_t rowBytes = (size_t)width * 3;
+	size_t rawSize = (rowBytes + 1) * height;	// Every row starts with its filter type
+	size_t blocks = std::max((rawSize + STORED_BLOCK_SIZE - 1) / STORED_BLOCK_SIZE, (size_t)1);
+	encoded.clear();
+	const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	encoded.insert(encoded.end(), signature, signature + 8);
+
+	size_t start = encoded.size();
+	beginChunk(encoded, "IHDR", 13);
+	putBigEndian(encoded, (uint32_t)width);
+	putBigEndian(encoded, (uint32_t)height);
+	const unsigned char header[5] = { 8, 2, 0, 0, 0 };	// 8 bit RGB, deflate, no filtering, no interlacing
+	encoded.insert(encoded.end(), header, header + 5);
+	endChunk(encoded, start);
+
+	// One zlib stream of stored blocks, the rows are copied through block by block
+	start = encoded.size();
+	beginChunk(encoded, "IDAT", (uint32_t)(2 + blocks * 5 + rawSize + 4));
+	encoded.push_back(0x78);	// zlib header, 32K window and no preset dictionary
+	encoded.push_back(0x01);
+	uint32_t adlerA = 1, adlerB = 0;
+	size_t rawOffset = 0;
+	for (size_t block = 0; block < blocks; block++) {
+		size_t length = std::min(rawSize - rawOffset, STORED_BLOCK_SIZE);
+		encoded.push_back(block + 1 == blocks ? 1 : 0);
+		encoded.push_back((unsigned char)length);
+		encoded.push_back((unsigned char)(length >> 8));
+		encoded.push_back((unsigned char)~length);
+		encoded.push_back((unsigned char)(~length >> 8));
+		for (size_t end = rawOffset + length; rawOffset < end;) {
+			size_t row = rawOffset / (rowBytes + 1);
+			size_t column = rawOffset % (rowBytes + 1);
+			const unsigned char* source;
+			size_t amount;
+			unsigned char filter = 0;
+			if (column == 0) {
+				source = &filter;
+				amount = 1;
+			}
+			else {
+				source = canvas.pixels() + row * rowBytes + column - 1;
+				amount = std::min(rowBytes - (column - 1), end - rawOffset);
+			}
+			encoded.insert(encoded.end(), source, source + amount);
+			for (size_t i = 0; i < amount; i++) {
+				adlerA = (adlerA + source[i]) % 65521;
+				adlerB = (adlerB + adlerA) % 65521;
+			}
+			rawOffset += amount;
+		}
+	}
+	putBigEndian(encoded, (adlerB << 16) | adlerA);
+	endChunk(encoded, start);
+
+	start = encoded.size();
+	beginChunk(encoded, "IEND", 0);
+	endChunk(encoded, start);
+
+	char name[32];
+	snprintf(name, sizeof(name), "_%06zu.png", frameNumber);
+	FILE* file = fopen((path + name).c_str(), "wb");
+	if (file == NULL) return 0;
+	bool written = fwrite(encoded.data(), 1, encoded.size(), file) == encoded.size();
+	return (fclose(file) == 0) && written;
+}
+
+int FrameEncoder::writeY4M() {
+	// Full range BT.601 (what C420jpeg players assume), chroma averaged over every 2x2 block
+	int width = canvas.width();
+	int height = canvas.height();
+	int chromaWidth = (width + 1) / 2;
+	int chromaHeight = (height + 1) / 2;
+	size_t lumaSize = (size_t)width * height;
+	size_t chromaSize = (size_t)chromaWidth * chromaHeight;
+	encoded.resize(lumaSize + 2 * chromaSize);
+	unsigned char* luma = encoded.data();
+	unsigned char* blue = luma + lumaSize;
+	unsigned char* red = blue + chromaSize;
+	const unsigned char* pixels = canvas.pixels();
+	for (size_t i = 0; i < lumaSize; i++) {
+		const unsigned char* pixel = pixels + i * 3;
+		luma[i] = (unsigned char)((77 * pixel[0] + 150 * pixel[1] + 29 * pixel[2] + 128) >> 8);
+	}
+	for (int y = 0; y < chromaHeight; y++) {
+		for (int x = 0; x < chromaWidth; x++) {
+			int sumR = 0, sumG = 0, sumB = 0, count = 0;
+			for (int py = 2 * y; py < std::min(2 * y + 2, height); py++) {
+				for (int px = 2 * x; px < std::min(2 * x + 2, width); px++) {
+					const unsigned char* pixel = pixels + ((size_t)py * width + px) * 3;
+					sumR += pixel[0];
+					sumG += pixel[1];
+					sumB += pixel[2];
+					count++;
+				}
+			}
+			int r = sumR / count, g = sumG / count, b = sumB / count;
+			blue[(size_t)y * chromaWidth + x] = (unsigned char)std::min((-43 * r - 85 * g + 128 * b + 32896) >> 8, 255);
+			red[(size_t)y * chromaWidth + x] = (unsigned char)std::min((128 * r - 107 * g - 21 * b + 32896) >> 8, 255);
+		}
+	}
+	if (fputs("FRAME\n", stream) < 0) return 0;
+	return fwrite(encoded.data(), 1, encoded.size(), stream) == encoded.size();
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include "RenderState.h"
+#include "OffscreenRenderer.h"
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Captures frames to disk on a background thread
+//	The caller copies a frame into a RenderState and hands it over, the worker draws it with an OffscreenRenderer and
+//	encodes it. There are only a few RenderStates, when all of them are waiting to be encoded acquireFrame returns NULL
+//	and the caller skips the frame, so a slow disk costs captured frames and never simulation time.
+//	PNGs are uncompressed (stored deflate blocks), big but cheap to write. Y4M is a raw 4:2:0 stream ffmpeg and most
+//	players read directly, with a nominal 60 frames per second since frames are captured per update rather than per second.
+enum CaptureFormat {
+	CAPTURE_PNG,				// path_000042.png for frame 42
+	CAPTURE_Y4M					// Every frame in one file at path
+};
+
+class FrameEncoder {
+public:
+	~FrameEncoder();			// Finishes what is queued
+	int open(const char* path, CaptureFormat format, int width, int height, const RenderPalette& palette);	// Returns 0 if the output can't be created
+	RenderState* acquireFrame();	// A frame to fill, NULL if the encoder is behind (never waits)
+	void submit(RenderState* frame);
+	int close();				// Encodes everything submitted, returns 1 if every frame was written
+	bool isOpen() const;
+	size_t droppedFrames() const;	// acquireFrame calls that returned NULL, read it from the thread that captures
+
+private:
+	static const int FRAME_SLOTS = 3;
+	RenderState frames[FRAME_SLOTS];
+	std::vector<RenderState*> freeFrames;
+	std::deque<RenderState*> queuedFrames;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::thread worker;
+	bool stopping = false;
+	bool failed = false;
+	size_t dropped = 0;			// Only changed by the thread that captures
+
+	// Only touched by the worker while it runs
+	CaptureFormat format = CAPTURE_PNG;
+	std::string path;
+	FILE* stream = NULL;		// Y4M only
+	RenderPalette palette;
+	OffscreenRenderer canvas;
+	std::vector<unsigned char> encoded;
+
+	void run();
+	int encode(const RenderState& frame);
+	int writePNG(size_t frameNumber);
+	int writeY4M();
+};
@@ -4,24 +4,63 @@
 #include <cstdlib>
 #include <limits>
 #include <cmath>
+#include <cstring>
+#include <string>
 #include <algorithm>
-#include <set>
+#include "Parallel.h"
+#include "Morton.h"
 
 #define FLAG_IS_SET(flag) (((flag) & (flags)) == (flag))
 
-size_t id_count = 0;
+static const int BROADPHASE_FLAGS = BRUTE_FORCE_CIRCLE | BRUTE_FORCE_AABB | SWEEP_AND_PRUNE_AABB | VARIANCE_SWEEP_AND_PRUNE_AABB | UNIFORM_GRID_AABB | LINEAR_BVH_AABB | NEIGHBOR_LIST_AABB;
+static const int ADAPTIVE_BROADPHASES[BROADPHASE_KINDS] = { BRUTE_FORCE_AABB, SWEEP_AND_PRUNE_AABB, UNIFORM_GRID_AABB, LINEAR_BVH_AABB };	// By BroadphaseKind
+
+static BroadphaseKind adaptiveKind(int flags) {	// Sweep and prune unless the flags name one of the others
+	for (int i = 0; i < BROADPHASE_KINDS; i++) {
+		if ((flags & BROADPHASE_FLAGS) == ADAPTIVE_BROADPHASES[i]) return (BroadphaseKind)i;
+	}
+	return BROADPHASE_SWEEP_AND_PRUNE;
+}
+
+uint32_t id_count = 0;
 char Game::sortAxis = 'x';
+static const size_t SNAPSHOT_BYTES_PER_FRAME = 4 << 20;	// How much of a snapshot beginSnapshot writes out per update
+static const int LOD_TILE_PIXELS = 16;			// Size of the level of detail tiles on screen
+static const float LOD_MIN_RADIUS = 1.0f;		// Objects with a smaller radius on screen are folded into their tile
+static const float LOD_MAX_COVERAGE = 2.0f;		// Tiles whose objects add up to more than this many times their area are drawn as a whole
+static const float LOD_MIN_ALPHA = 0.25f;		// Tiles of a few tiny objects still show up
+static const float FAT_BOX_MARGIN = 1.0f;		// Room around every fat box besides the predicted motion
+static const float FAT_BOX_LOOKAHEAD = 4.0f;	// Frames of motion at the current velocity a fat box makes room for
+static const float FAT_BOX_MAX_REACH = 16.0f;	// Cap on that room along each axis, fast objects are just refattened more often
+static const int REORDER_CHECK_INTERVAL = 30;	// Frames between looks at how scattered object storage has become
+static const float REORDER_SPREAD_GROWTH = 1.5f;	// Storage is reordered once neighbors in it are this much further apart than after the last reorder
+static const size_t SWEEP_MIN_CHUNK_SIZE = 2048;	// Below this many objects per thread sweep and prune stays on one thread
+static const size_t SWEEP_SAMPLE_STRIDE = 16;		// Every this many objects one is measured for how far its sweep reaches
+static const size_t STRICT_ALLOCATION_WARMUP = 120;	// Updates after the scene changed shape before a frame counts as settled
 
-Game::Game(const int width, const int height, const int numObjects, const int flags) {
+Game::Game(const int width, const int height, const int numObjects, const int flags, const int numStaticObjects) {
 	this->flags = flags;
+	if (FLAG_IS_SET(ADAPTIVE_BROADPHASE)) this->flags = (flags & ~BROADPHASE_FLAGS) | ADAPTIVE_BROADPHASES[adaptiveKind(flags)];
+	selectPipeline();
 	
 	// SDL init
-	SDL_Init(SDL_INIT_EVERYTHING);
 	running = true;
-	window = SDL_CreateWindow("title", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, width, height, SDL_WINDOW_SHOWN);
+	simulationRate = 0;
 	windowWidth = width;
 	windowHeight = height;
-	renderer = SDL_CreateRenderer(window, -1, 0);
+	camera.x = width / 2.0f;	// Showing the whole world one to one, which is how it is drawn without a camera
+	camera.y = height / 2.0f;
+	worldQuantizer.fit(0, 0, (float)width, (float)height);
+	if (FLAG_IS_SET(HEADLESS)) {	// Nothing is ever drawn
+		SDL_Init(0);
+		window = NULL;
+		renderer = NULL;
+	}
+	else {
+		SDL_Init(SDL_INIT_EVERYTHING);
+		window = SDL_CreateWindow("title", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, width, height, SDL_WINDOW_SHOWN);
+		renderer = SDL_CreateRenderer(window, -1, 0);
+	}
 	totalFrames = 0;
 	totalRuntime = 0;
 	fpsTimer = 0;
@@ -31,33 +70,46 @@ Game::Game(const int width, const int height, const int numObjects, const int fl
 
 	// Board init
 	for (int i = 0; i < numObjects; i++) {	// Adding test objects
-		Object* test = new Object(float(rand() % windowWidth), float(rand() % windowHeight), 5, id_count);
-		id_count += 1;
+		Object* test = getObject(spawnObject(float(rand() % windowWidth), float(rand() % windowHeight), 5));
 		test->acc.x = (float)(rand() % 100 + 1) / 20;
 		test->acc.y = (float) 500;
-		
-		// Adding colliders
-		if (FLAG_IS_SET(BRUTE_FORCE_AABB) || 
-			FLAG_IS_SET(SWEEP_AND_PRUNE_AABB) || 
-			FLAG_IS_SET(UNIFORM_GRID_AABB) ||
-			FLAG_IS_SET(VARIANCE_SWEEP_AND_PRUNE_AABB)) {
-			test->createAABB();
+		if (FLAG_IS_SET(TEAM_COLLISION_LAYERS)) {	// Teammates pass through each other
+			bool red = (i % 2 == 0);
+			test->filter.category = red ? CATEGORY_RED_TEAM : CATEGORY_BLUE_TEAM;
+			test->filter.mask = CATEGORY_ALL & ~test->filter.category;
+			test->color = red ? Color(255, 64, 64, 255) : Color(64, 64, 255, 255);
 		}
-		
-		objects.push_back(test);
-
 	}
-	if (FLAG_IS_SET(UNIFORM_GRID_AABB)) {
-		int cellSize = (int)(objects[0]->radius * 2);
+	for (int i = 0; i < numStaticObjects; i++) {	// Adding static geometry, these never move
+		Object* wall = getObject(spawnObject(float(rand() % windowWidth), float(rand() % windowHeight), 5, true));
+		wall->color = staticColor;
+	}
+	applySpawnsAndDespawns();
+	int cellSize = objects.empty() ? 24 : (int)(4 * (objects[0]->radius + FAT_BOX_MARGIN));	// Two resting fat boxes across, so most objects are in one to four cells
+	if (FLAG_IS_SET(UNIFORM_GRID_AABB) || FLAG_IS_SET(ADAPTIVE_BROADPHASE)) {	// The adaptive broadphase can switch to the grid any time
 		uniformGrid = UniformGrid(cellSize, cellSize, width, height);
 	}
+	if (FLAG_IS_SET(ADAPTIVE_BROADPHASE)) {
+		broadphaseSelector = BroadphaseSelector((float)cellSize, (float)width, (float)height);
+		broadphaseSelector.reset(adaptiveKind(this->flags));
+	}
 
 	// Deltatime setup
 	lastTime = std::chrono::steady_clock::now();		// For deltatime calculations
 	deltaTime = 0;
+
+	// The first frame starts here
+	for (int i = 0; i < ALLOCATION_SUBSYSTEMS; i++) {
+		allocationsAtFrameEnd[i] = allocationCounters((AllocationSubsystem)i);
+	}
+	allocationsAtPrint = allocationTotals();
+	resetAllocationPeaks();
 }
 
 Game::~Game() {
+	running = false;	// The simulation thread finishes its frame and stops
+	if (simulationThread.joinable()) simulationThread.join();
+
 	// Printing Metrics
 	if (PRINT_METRICS & flags) {
 		printf("Total Runtime:         %20.10f\n", totalRuntime);
@@ -67,21 +119,297 @@ Game::~Game() {
 		printf("Minimum Framerate:     %20.10f\n", minFPS);
 		printf("Framerate Variability: %20.10f\n", maxFPS - minFPS);
 		printf("Frames per Object:  %20.10f\n", totalFrames / (float)objects.size());
+		if (FLAG_IS_SET(ADAPTIVE_BROADPHASE)) printf("Broadphase Switches:   %20.10zu\n", broadphaseSelector.getSwitches());
+		printf("Allocations by subsystem over the whole program (count, bytes, live bytes):\n");
+		for (int i = 0; i < ALLOCATION_SUBSYSTEMS; i++) {
+			AllocationCounters counters = allocationCounters((AllocationSubsystem)i);
+			printf("  %-12s %12llu %16llu %16lld\n", allocationSubsystemName((AllocationSubsystem)i), (unsigned long long)counters.allocations, (unsigned long long)counters.bytes, (long long)counters.live);
+		}
+		if (allocationFailure != 0) printf("Allocation Failure:    %20.10zu\n", allocationFailure);
 		//std::string response;
 		//std::cout << "Enter any character to close: ";
 		//std::cin >> response;
 	}
 
+	if (snapshotWriter.isWriting()) snapshotWriter.finish();	// A snapshot that was still being written is finished, not lost
+	stopRecording();
+	stopCapture();
+
 	// Object cleanup
-	if (flags & BRUTE_FORCE_AABB) {
+	applySpawnsAndDespawns();	// So nothing that is still queued gets missed
+	for (auto object : objects) {
+		destroyObject(object);
+	}
+	for (auto wall : staticObjects) {
+		destroyObject(wall);
+	}
+	objects.clear();
+	staticObjects.clear();
+
+	batchRenderer.release();	// Its textures belong to the renderer
+	if (renderer != NULL) SDL_DestroyRenderer(renderer);
+	if (window != NULL) SDL_DestroyWindow(window);
+	SDL_Quit();
+}
+
+Object* Game::createObject(float x, float y, float radius, bool withAABB) {
+	Handle handle = objectPool.allocate(x, y, radius, id_count);
+	id_count += 1;
+	Object* object = objectPool.get(handle);
+	object->handle = handle;
+	if (withAABB) object->createAABB();
+	return object;
+}
+
+void Game::destroyObject(Object* object) {
+	object->destroyAABB();
+	objectPool.free(object->handle);
+}
+
+bool Game::usesAABB() {
+	return FLAG_IS_SET(BRUTE_FORCE_AABB) ||
+		FLAG_IS_SET(SWEEP_AND_PRUNE_AABB) ||
+		FLAG_IS_SET(UNIFORM_GRID_AABB) ||
+		FLAG_IS_SET(VARIANCE_SWEEP_AND_PRUNE_AABB) ||
+		FLAG_IS_SET(LINEAR_BVH_AABB) ||
+		FLAG_IS_SET(NEIGHBOR_LIST_AABB);
+}
+
+bool Game::usesFatBoxes() {
+	return FLAG_IS_SET(SWEEP_AND_PRUNE_AABB) ||
+		FLAG_IS_SET(VARIANCE_SWEEP_AND_PRUNE_AABB) ||
+		FLAG_IS_SET(UNIFORM_GRID_AABB);
+}
+
+void Game::fattenBox(Object* object, float timestep) {
+	// Capped, otherwise a slow frame (big timestep) makes huge boxes that make the next frame slower still
+	vector displacement = object->vel * (timestep * FAT_BOX_LOOKAHEAD);
+	displacement.x = std::min(std::max(displacement.x, -FAT_BOX_MAX_REACH), FAT_BOX_MAX_REACH);
+	displacement.y = std::min(std::max(displacement.y, -FAT_BOX_MAX_REACH), FAT_BOX_MAX_REACH);
+	object->fatBox.fatten(*object->AABB, displacement, FAT_BOX_MARGIN);
+}
+
+void Game::refreshFatBoxes() {
+	for (auto object : objects) {
+		if (object->fatBox.contains(*object->AABB)) continue;	// Most objects are still inside theirs
+		dirtyObjects.emplace_back(object, object->fatBox);
+		fattenBox(object, deltaTime);
+	}
+}
+
+void Game::resetFatBoxes() {
+	for (auto object : objects) {
+		object->fatBox = FatBox();
+	}
+	dirtyObjects.clear();
+	uniformGrid.clearCells();
+}
+
+void Game::updateStorageOrder() {
+	if (reorderInterval <= 0 || objects.size() < 2) return;
+	framesSinceReorder++;
+	if (framesSinceReorder < reorderInterval && framesSinceReorder % REORDER_CHECK_INTERVAL != 0) return;
+
+	// Sweep and prune keeps objects in its sorted order no matter how scattered they get, so there only the interval counts.
+	// Everywhere else objects move away from their neighbors in storage and spawns are appended wherever they are
+	bool due = framesSinceReorder >= reorderInterval || spreadAfterReorder < 0;
+	if (!due && sortedAxis == 0) due = orderSpread() > REORDER_SPREAD_GROWTH * spreadAfterReorder;
+	if (due) reorderStorage();
+}
+
+void Game::reorderStorage() {
+	storageReorders++;
+	framesSinceReorder = 0;
+
+	// Objects sorted along a Morton curve over their bounds, unless sweep and prune already keeps them sorted along an axis
+	if (sortedAxis == 0) {
+		float minX = std::numeric_limits<float>::infinity(), minY = minX;
+		float maxX = -minX, maxY = -minX;
+		for (auto object : objects) {
+			minX = std::min(minX, object->pos.x);
+			minY = std::min(minY, object->pos.y);
+			maxX = std::max(maxX, object->pos.x);
+			maxY = std::max(maxY, object->pos.y);
+		}
+		float scaleX = (maxX > minX) ? 65535 / (maxX - minX) : 0;
+		float scaleY = (maxY > minY) ? 65535 / (maxY - minY) : 0;
+		reorderKeys.resize(objects.size());
 		for (size_t i = 0; i < objects.size(); i++) {
-			objects[i]->destroyAABB();
+			unsigned int x = (unsigned int)((objects[i]->pos.x - minX) * scaleX);
+			unsigned int y = (unsigned int)((objects[i]->pos.y - minY) * scaleY);
+			reorderKeys[i] = std::make_pair(mortonCode(x, y), (unsigned int)i);
 		}
+		std::sort(reorderKeys.begin(), reorderKeys.end());	// Ties go by the old order, so a replay reorders the same way
+		reordered.resize(objects.size());
+		for (size_t i = 0; i < objects.size(); i++) {
+			reordered[i] = objects[reorderKeys[i].second];
+		}
+		objects.swap(reordered);
 	}
 
-	SDL_DestroyRenderer(renderer);
-	SDL_DestroyWindow(window);
-	SDL_Quit();
+	// Storage follows objects, after which every Object pointer has to be looked up again through its handle
+	reorderHandles.resize(objects.size());
+	for (size_t i = 0; i < objects.size(); i++) {
+		reorderHandles[i] = objects[i]->handle;
+	}
+	objectPool.reorder(reorderHandles);
+	for (size_t i = 0; i < objects.size(); i++) {
+		objects[i] = objectPool.get(reorderHandles[i]);
+	}
+	spreadAfterReorder = orderSpread();
+
+	// The grid and the neighbor list still hold the old pointers, they start over on the next pass. Only the grid reads dirtyObjects
+	if (FLAG_IS_SET(UNIFORM_GRID_AABB)) resetFatBoxes();
+	dirtyObjects.clear();
+	neighborList.invalidate();
+}
+
+float Game::orderSpread() {
+	float total = 0;
+	for (size_t i = 1; i < objects.size(); i++) {
+		total += std::abs(objects[i]->pos.x - objects[i - 1]->pos.x) + std::abs(objects[i]->pos.y - objects[i - 1]->pos.y);
+	}
+	return total / (objects.size() - 1);
+}
+
+Handle Game::spawnObject(float x, float y, float radius, bool isStatic) {
+	AllocationScope scope(ALLOCATION_SPAWNING);
+	Object* object = createObject(x, y, radius, isStatic || usesAABB());	// Static objects always need an AABB for the static BVH
+	object->isStatic = isStatic;
+	if (isStatic) object->filter.category = CATEGORY_STATIC;
+	pendingSpawns.push_back(object);
+	return object->handle;
+}
+
+int Game::despawnObject(Handle handle) {
+	AllocationScope scope(ALLOCATION_SPAWNING);
+	Object* object = getObject(handle);
+	if (object == NULL) return 0;
+	pendingDespawns.push_back(object);
+	return 1;
+}
+
+Object* Game::getObject(Handle handle) {
+	return objectPool.get(handle);
+}
+
+int Game::applyForce(Handle handle, const vector& force) {
+	if (getObject(handle) == NULL) return 0;
+	pendingForces.push_back(std::make_pair(handle, vector(force.x, force.y)));
+	return 1;
+}
+
+void Game::applyForces() {
+	for (auto& pending : pendingForces) {
+		Object* object = getObject(pending.first);	// The object can have been despawned since
+		if (object == NULL || object->isStatic) continue;
+		object->vel = object->vel + pending.second * (deltaTime / object->mass);
+		if (replayWriter.isOpen()) {
+			ReplayForce force;
+			force.index = replayIndices[object->id];
+			force.force = vector(pending.second.x, pending.second.y);
+			recordedFrame.forces.push_back(force);
+		}
+	}
+	pendingForces.clear();
+}
+
+void Game::applySpawnsAndDespawns() {
+	if (pendingSpawns.empty() && pendingDespawns.empty()) return;
+
+	// Despawns, every list is filtered in a single pass no matter how many objects go
+	size_t objectCount = objects.size() + staticObjects.size();
+	std::sort(pendingDespawns.begin(), pendingDespawns.end());
+	pendingDespawns.erase(std::unique(pendingDespawns.begin(), pendingDespawns.end()), pendingDespawns.end());
+	auto isDespawned = [&](Object* object) {
+		return std::binary_search(pendingDespawns.begin(), pendingDespawns.end(), object);
+	};
+	if (!pendingDespawns.empty()) {
+		objects.erase(std::remove_if(objects.begin(), objects.end(), isDespawned), objects.end());
+		staticObjects.erase(std::remove_if(staticObjects.begin(), staticObjects.end(), isDespawned), staticObjects.end());
+		pendingSpawns.erase(std::remove_if(pendingSpawns.begin(), pendingSpawns.end(), isDespawned), pendingSpawns.end());
+
+		// The grid still has dirty objects under the box they had before, or not at all if they were never added to it
+		for (auto& dirty : dirtyObjects) {
+			if (isDespawned(dirty.first)) dirty.first->fatBox = dirty.second;
+		}
+		dirtyObjects.erase(std::remove_if(dirtyObjects.begin(), dirtyObjects.end(), [&](const std::pair<Object*, FatBox>& dirty) { return isDespawned(dirty.first); }), dirtyObjects.end());
+	}
+	if (objects.size() + staticObjects.size() != objectCount || !pendingSpawns.empty()) {
+		neighborList.invalidate();	// Listed pairs could point at despawned objects and miss the new ones. Replays only see what really changed
+	}
+
+	// Recording what actually changed, spawns that were despawned again before this point never happened
+	if (replayWriter.isOpen()) {
+		for (auto object : pendingDespawns) {
+			auto found = replayIndices.find(object->id);
+			if (found == replayIndices.end()) continue;
+			recordedFrame.despawns.push_back(found->second);
+			replayIndices.erase(found);
+		}
+		std::sort(recordedFrame.despawns.begin(), recordedFrame.despawns.end());
+		for (auto object : pendingSpawns) {
+			ReplaySpawn spawn;
+			spawn.pos = object->pos;
+			spawn.vel = object->vel;
+			spawn.acc = object->acc;
+			spawn.radius = object->radius;
+			spawn.mass = object->mass;
+			spawn.color = object->color;
+			spawn.filter = object->filter;
+			spawn.isStatic = object->isStatic;
+			spawn.isVisible = object->isVisible;
+			recordedFrame.spawns.push_back(spawn);
+			replayIndices[object->id] = nextReplayIndex++;
+		}
+	}
+
+	// Spawns, new moving objects get their fat box right away so sweep and prune can merge them by it
+	size_t firstDynamic = objects.size();
+	size_t firstStatic = staticObjects.size();
+	for (auto object : pendingSpawns) {
+		if (object->isStatic) {
+			staticObjects.push_back(object);
+			continue;
+		}
+		objects.push_back(object);
+		if (usesFatBoxes()) {
+			dirtyObjects.emplace_back(object, FatBox());
+			fattenBox(object, 0);	// This frame's step isn't known yet (and a replay wouldn't know the last one)
+		}
+	}
+	if (sortedAxis == 'x' && firstDynamic < objects.size()) {	// Sweep and prune keeps objects sorted, so the new ones are sorted and merged in
+		std::sort(objects.begin() + firstDynamic, objects.end(), MinAlong<AxisX>());
+		std::inplace_merge(objects.begin(), objects.begin() + firstDynamic, objects.end(), MinAlong<AxisX>());
+	}
+	else if (sortedAxis == 'y' && firstDynamic < objects.size()) {
+		std::sort(objects.begin() + firstDynamic, objects.end(), MinAlong<AxisY>());
+		std::inplace_merge(objects.begin(), objects.begin() + firstDynamic, objects.end(), MinAlong<AxisY>());
+	}
+
+	// The static BVH is only rebuilt for big batches, otherwise objects are inserted and removed one at a time
+	size_t staticChanges = staticObjects.size() - firstStatic;
+	for (auto object : pendingDespawns) {
+		if (object->isStatic) staticChanges++;
+	}
+	if (staticChanges * 4 > staticBVH.size()) {
+		staticBVH.build(staticObjects);
+	}
+	else {
+		for (auto object : pendingDespawns) {
+			if (object->isStatic) staticBVH.remove(object);
+		}
+		for (size_t i = firstStatic; i < staticObjects.size(); i++) {
+			staticBVH.insert(staticObjects[i]);
+		}
+	}
+
+	for (auto object : pendingDespawns) {
+		if (FLAG_IS_SET(UNIFORM_GRID_AABB) && !object->isStatic) uniformGrid.remove(object, object->fatBox);
+		destroyObject(object);
+	}
+	pendingSpawns.clear();
+	pendingDespawns.clear();
 }
 
 int Game::handleEvents() {
@@ -94,6 +422,10 @@ int Game::handleEvents() {
 	case SDL_QUIT:
 		running = false;
 		break;
+	case SDL_RENDER_TARGETS_RESET:	// The sprite atlas lost its contents
+	case SDL_RENDER_DEVICE_RESET:
+		batchRenderer.invalidate();
+		break;
 	default:
 		break;
 	}
@@ -125,11 +457,13 @@ void Game::handleCollision(Object& a, Object& b) {	// Supposedly, a collision wi
 }
 
 void Game::updatePositions() {
+	float displacement = 0;
 	for (auto i = 0; i < objects.size(); i++) {
 		if (!objects[i]->isStatic) {
 			// Movement
 			objects[i]->vel = objects[i]->vel + objects[i]->acc * deltaTime;
 			objects[i]->pos = objects[i]->pos + objects[i]->vel * deltaTime;
+			displacement = std::max(displacement, std::max(std::abs(objects[i]->vel.x), std::abs(objects[i]->vel.y)) * deltaTime);
 
 			// Collision with edges
 			if (objects[i]->pos.x + objects[i]->radius >= windowWidth || objects[i]->pos.x - objects[i]->radius < 0) {	// on x axis
@@ -140,14 +474,36 @@ void Game::updatePositions() {
 			}
 		}
 	}
+	maxDisplacement = displacement;
 }
 
 int Game::update() {
-	// Deltatime
 	auto currentTime = std::chrono::steady_clock::now();
-	deltaTime = std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(currentTime - lastTime).count() / 1000;
-	lastTime = currentTime;
+	return update(std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(currentTime - lastTime).count() / 1000);
+}
+
+int Game::update(float timestep) {
+	frameArena.reset();	// Nothing from the last frame is needed anymore
+	if (!pendingSpawns.empty() || !pendingDespawns.empty()) settledFrames = 0;
+	{
+		AllocationScope scope(ALLOCATION_SPAWNING);
+		applySpawnsAndDespawns();
+		updateStorageOrder();
+	}
+	if (FLAG_IS_SET(ADAPTIVE_BROADPHASE)) {
+		AllocationScope scope(ALLOCATION_COLLISION);
+		chooseBroadphase();
+	}
+	if (snapshotWriter.isWriting()) {
+		AllocationScope scope(ALLOCATION_SNAPSHOTS);
+		snapshotWriter.writeSome(SNAPSHOT_BYTES_PER_FRAME);
+	}
+
+	// Deltatime
+	deltaTime = timestep;
+	lastTime = std::chrono::steady_clock::now();
 	if (DEBUG_UPDATE & flags) std::cout << "Deltatime = " << deltaTime << " seconds" << std::endl;
+	applyForces();
 
 	// Metrics
 	totalFrames++;
@@ -161,280 +517,607 @@ int Game::update() {
 		float fps = countedFrames / fpsTimer;
 		if (fps > maxFPS)	maxFPS = fps;
 		if (fps < minFPS)	minFPS = fps;
-		if (PRINT_METRICS & flags) {
-			std::cout << fps << std::endl;
+		if (PRINT_METRICS & flags) {	// With the allocations per frame since the last line
+			AllocationCounters totals = allocationTotals();
+			std::cout << fps << "\t" << (totals.allocations - allocationsAtPrint.allocations) / (double)countedFrames << " allocations, "
+				<< (totals.bytes - allocationsAtPrint.bytes) / (double)countedFrames << " bytes a frame, " << peakSincePrint / 1024 << " KB peak" << std::endl;
+			allocationsAtPrint = totals;
+			peakSincePrint = 0;
 		}
 		fpsTimer = 0;
 		countedFrames = 0;
 	}
 	
-	// Determine what kind of collision detection are we using (set through flags from constructor)
+	// Collision detection and response, through the pipeline compiled for this game's flags (see selectPipeline)
 	if (DEBUG_UPDATE & flags) std::cout << "Calculating Collisions!" << std::endl;
-	if (BRUTE_FORCE_CIRCLE & flags) {
-		for (size_t i = 0; i < objects.size(); i++) {
-			for (size_t j = i + 1; j < objects.size(); j++) {
-				if (boundingCircleCollision(*objects[i], *objects[j])) {
-					/*std::cout << "Collision moment\n";*/
-					objects[i]->color.b = 0;
-					objects[i]->color.g = 0;
-					objects[j]->color.b = 0;
-					objects[j]->color.a = 255;
-					handleCollision(*objects[i], *objects[j]);
-				}
-			}
-		}
+	if (FLAG_IS_SET(CONTACT_EVENTS)) contactCache.beginFrame();
+	{
+		AllocationScope scope(ALLOCATION_COLLISION);
+		auto collisionStart = std::chrono::steady_clock::now();
+		(this->*collisionPasses[sortAxis == 'y'])();
+		lastCollisionMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - collisionStart).count();
+		broadphaseFrame = totalFrames;
+		dirtyObjects.clear();
+		if (FLAG_IS_SET(CONTACT_EVENTS)) contactCache.endFrame(totalFrames);	// Every contact is known now, so the ones that weren't seen have ended
 	}
-	else if (BRUTE_FORCE_AABB & flags) {
-		for (size_t i = 0; i < objects.size(); i++) {
-			for (size_t j = i + 1; j < objects.size(); j++) {
-				if (AABBCollision(*objects[i], *objects[j])) {
-					//std::cout << "Collision moment\n";
-					objects[i]->color.b = 0;
-					objects[i]->color.g = 0;
-					objects[j]->color.b = 0;
-					objects[j]->color.a = 255;
-					handleCollision(*objects[i], *objects[j]);
-				}
-			}
-		}
+
+	// Update Object Positions
+	if (DEBUG_UPDATE & flags) std::cout << "Calculating Object Updates!" << std::endl;
+	{
+		AllocationScope scope(ALLOCATION_INTEGRATION);
+		updatePositions();
 	}
-	else if (FLAG_IS_SET(SWEEP_AND_PRUNE_AABB) || FLAG_IS_SET(VARIANCE_SWEEP_AND_PRUNE_AABB)) {
-		// Sort the object array in ascending order based on an axis (it doesn't matter which)
-		//	The axis will be chosen through sortAxis
-		//	cmpAABBPositions(const Object* a, const Object* b)
-		//		Comparison function
-		//		if sortAxis = x
-		//			minA = a.min.x
-		//			minB = b.min.x
-		//		etc...
-		//		if (minA < minB) return true
-		//		else return false
-		//	sort(objects.begin(), objects.end(), cmpAABBPositions)
-		// Check for overlapping colliders
-		//	AABBOverlap(const Object* a, const Object* b)
-		//		if min(a) <= min(b) <= max(a), there is overlap
-		//		else if min(a) <= max(b) <= max(a), there is overlap
-		//		otherwise, no overlap
-		// Check the overlapping colliders for collisions
-		// OPTIONAL (Could maybe add this as an additional collision detection method)
-		//	Calculate the variance (maxOverallPosition - minOverallPosition) of each axis
-		//	Update sortAxis to the axis with the most variance
-
-
-		// For variance based sweep and prune
-		float xVariance, yVariance;	
-		float minX = std::numeric_limits<float>::infinity();
-		float maxX = 0;
-		float minY = std::numeric_limits<float>::infinity();
-		float maxY = 0;
-		std::sort(objects.begin(), objects.end(), cmpAABBPositions);
-		//for (size_t i = 0; i < objects.size(); i++) {
-		//	std::cout << objects[i]->AABB->min().x << std::endl;
-		//}
-		for (size_t i = 0; i < objects.size(); i++) {
-			if (FLAG_IS_SET(VARIANCE_SWEEP_AND_PRUNE_AABB)) {	// Recording the maximums and minimums for the calculation of variance
-				if (objects[i]->AABB->max().x > maxX) maxX = objects[i]->AABB->max().x;
-				if (objects[i]->AABB->min().x < minX) minX = objects[i]->AABB->min().x;
-				if (objects[i]->AABB->max().y > maxY) maxY = objects[i]->AABB->max().y;
-				if (objects[i]->AABB->min().y > minY) minY = objects[i]->AABB->min().y;
-			}
-			for (size_t j = i + 1; j < objects.size(); j++) {	// Only looking at objects after the 'i'th object as to not waste time
-				if (objects[j]->AABB->min().x > objects[i]->AABB->max().x) {
-					break;
-				}
-				if (AABBOverlap(objects[i], objects[j])) {
-					objects[i]->lastOverlapFrame = totalFrames;
-					if (AABBCollision(*objects[i], *objects[j])) {
-						handleCollision(*objects[i], *objects[j]);
-					}
-				}
-			}
+
+	if (replayWriter.isOpen()) {
+		AllocationScope scope(ALLOCATION_REPLAYS);
+		recordedFrame.deltaTime = deltaTime;
+		recordedFrame.checksum = stateChecksum();
+		replayWriter.writeFrame(recordedFrame);
+		recordedFrame.clear();
+	}
+
+	if (FLAG_IS_SET(PIPELINED_RENDER) && !FLAG_IS_SET(HEADLESS)) {	// Serially, render publishes instead
+		AllocationScope scope(ALLOCATION_RENDERING);
+		publishRenderState();
+	}
+	if (frameEncoder.isOpen() && totalFrames % captureInterval == 0) {
+		AllocationScope scope(ALLOCATION_CAPTURE);
+		RenderState* frame = frameEncoder.acquireFrame();	// NULL while the encoder is behind, the frame is skipped rather than waited for
+		if (frame != NULL) {
+			fillRenderState(*frame);
+			frameEncoder.submit(frame);
 		}
-		if (FLAG_IS_SET(VARIANCE_SWEEP_AND_PRUNE_AABB)) {
-			xVariance = maxX - minX;
-			yVariance = maxY - minY;
-			if (xVariance >= yVariance) {
-				sortAxis = 'x';
-			}
-			else {
-				sortAxis = 'y';
-			}
+	}
+	endFrameAllocations();
+	return 0;
+}
+
+void Game::endFrameAllocations() {
+	settledFrames++;
+	frameAllocations.total = AllocationCounters();
+	for (int i = 0; i < ALLOCATION_SUBSYSTEMS; i++) {
+		AllocationCounters counters = allocationCounters((AllocationSubsystem)i);
+		AllocationCounters& frame = frameAllocations.subsystems[i];
+		frame.allocations = counters.allocations - allocationsAtFrameEnd[i].allocations;
+		frame.bytes = counters.bytes - allocationsAtFrameEnd[i].bytes;
+		frame.live = counters.live;
+		frame.peak = counters.peak;
+		frameAllocations.total.allocations += frame.allocations;
+		frameAllocations.total.bytes += frame.bytes;
+		allocationsAtFrameEnd[i] = counters;
+	}
+	AllocationCounters totals = allocationTotals();
+	frameAllocations.total.live = totals.live;
+	frameAllocations.total.peak = totals.peak;
+	peakSincePrint = std::max(peakSincePrint, totals.peak);
+	resetAllocationPeaks();
+
+	if (!FLAG_IS_SET(STRICT_ALLOCATIONS) || allocationFailure != 0 || settledFrames <= STRICT_ALLOCATION_WARMUP || frameAllocations.total.allocations == 0) return;
+	allocationFailure = totalFrames;
+	running = false;
+	printf("Frame %zu allocated %llu times (%llu bytes) after settling:\n", totalFrames, (unsigned long long)frameAllocations.total.allocations, (unsigned long long)frameAllocations.total.bytes);
+	for (int i = 0; i < ALLOCATION_SUBSYSTEMS; i++) {
+		const AllocationCounters& frame = frameAllocations.subsystems[i];
+		if (frame.allocations != 0) printf("  %-12s %12llu %16llu\n", allocationSubsystemName((AllocationSubsystem)i), (unsigned long long)frame.allocations, (unsigned long long)frame.bytes);
+	}
+}
+
+const Game::FrameAllocations& Game::getFrameAllocations() {
+	return frameAllocations;
+}
+
+size_t Game::getAllocationFailure() {
+	return allocationFailure;
+}
+
+int Game::startCapture(const char* path, CaptureFormat format, int interval) {
+	AllocationScope scope(ALLOCATION_CAPTURE);
+	captureInterval = std::max(interval, 1);
+	return frameEncoder.open(path, format, windowWidth, windowHeight, palette());
+}
+
+int Game::stopCapture() {
+	AllocationScope scope(ALLOCATION_CAPTURE);
+	return frameEncoder.close();
+}
+
+size_t Game::getDroppedCaptureFrames() {
+	return frameEncoder.droppedFrames();
+}
+
+void Game::setSimulationRate(float updatesPerSecond) {
+	simulationRate = updatesPerSecond;
+}
+
+void Game::simulate() {
+	lastTime = std::chrono::steady_clock::now();	// The time spent starting up isn't simulated
+	auto nextStep = lastTime;
+	while (running) {
+		float rate = simulationRate;
+		if (rate <= 0) {
+			update();
+			continue;
 		}
+		update(1 / rate);
+		nextStep += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(1 / rate));
+		auto now = std::chrono::steady_clock::now();
+		if (nextStep < now) nextStep = now;	// Behind schedule, the simulation slows down instead of trying to catch up
+		else std::this_thread::sleep_until(nextStep);
+	}
+}
+
+template <class Broadphase, class Narrowphase, class Response, class Axis>
+void Game::collide() {
+	findPairs<Narrowphase, Response, Axis>(Broadphase());
+
+	// Moving objects against the static geometry, walls are never tinted
+	if (!FindsStaticPairs<Broadphase>::value && !staticObjects.empty()) collideWithStatic<Narrowphase, BounceResponse<Response::recordContacts, false>>();
+}
 
+template <class Narrowphase, class Response>
+void Game::resolve(Object& a, Object& b) {
+	if (!Narrowphase::touching(a, b)) return;
+	a.lastCollisionFrame = totalFrames;
+	b.lastCollisionFrame = totalFrames;
+	if (Response::recordContacts) contactCache.addContact(a, b, totalFrames);
+	if (Response::recolor) {
+		a.color.b = 0;
+		a.color.g = 0;
+		b.color.b = 0;
+		b.color.a = 255;
 	}
-	else if (FLAG_IS_SET(UNIFORM_GRID_AABB)) {
-		uniformGrid.clearCells();
-		for (size_t i = 0; i < objects.size(); i++) {
-			std::set<Object*> possibleCollisions = uniformGrid.setCellsAndScoutCollision(objects[i]);
-			for (auto collisionObject : possibleCollisions) {
-				if (AABBCollision(*objects[i], *collisionObject)) {
-					handleCollision(*objects[i], *collisionObject);
-				}
-			}
+	handleCollision(a, b);
+}
+
+template <class Narrowphase, class Response, class Axis>
+void Game::findPairs(BruteForceBroadphase) {
+	for (size_t i = 0; i < objects.size(); i++) {
+		for (size_t j = i + 1; j < objects.size(); j++) {
+			if (!shouldCollide(objects[i]->filter, objects[j]->filter)) continue;
+			resolve<Narrowphase, Response>(*objects[i], *objects[j]);
 		}
 	}
+}
 
-	// Update Object Positions
-	if (DEBUG_UPDATE & flags) std::cout << "Calculating Object Updates!" << std::endl;
-	updatePositions();
+template <class Narrowphase, class Response, class Axis>
+void Game::findPairs(SweepAndPruneBroadphase) {
+	sweepAndPrune<Narrowphase, Response, Axis, false>();
+}
 
-	return 0;
+template <class Narrowphase, class Response, class Axis>
+void Game::findPairs(VarianceSweepAndPruneBroadphase) {
+	sweepAndPrune<Narrowphase, Response, Axis, true>();
 }
 
-void Game::DrawCircle(SDL_Renderer* renderer, Object& circle) {
-	float radius = circle.radius;
-	float centreX = circle.pos.x;
-	float centreY = circle.pos.y;
-	
-	const float diameter = (radius * 2);
+template <class Narrowphase, class Response, class Axis>
+void Game::findPairs(UniformGridBroadphase) {
+	// Only objects that left their fat box are moved, and most of those stay in the same cells
+	refreshFatBoxes();
+	for (auto& dirty : dirtyObjects) {
+		uniformGrid.move(dirty.first, dirty.second, dirty.first->fatBox);
+	}
+	size_t count;
+	std::pair<Object*, Object*>* pairs = uniformGrid.findPairs(frameArena, count);
+	for (size_t k = 0; k < count; k++) {
+		if (!shouldCollide(pairs[k].first->filter, pairs[k].second->filter)) continue;
+		resolve<Narrowphase, Response>(*pairs[k].first, *pairs[k].second);
+	}
+}
 
-	float x = (radius - 1);
-	float y = 0;
-	float tx = 1;
-	float ty = 1;
-	float error = (tx - diameter);
+template <class Narrowphase, class Response, class Axis>
+void Game::findPairs(LinearBVHBroadphase) {
+	// The hierarchy is rebuilt from scratch every frame, so it doesn't matter how far things moved
+	linearBVH.build(objects);
+	linearBVH.findPairs(bvhPairs);
+	for (auto& pair : bvhPairs) {
+		pair.first->lastOverlapFrame = totalFrames;
+		pair.second->lastOverlapFrame = totalFrames;
+		resolve<Narrowphase, Response>(*pair.first, *pair.second);
+	}
+}
 
-	while (x >= y)
-	{
-		//  Each of the following renders an octant of the circle
-		SDL_RenderDrawPoint(renderer, (int)(centreX + x), (int)(centreY - y));
-		SDL_RenderDrawPoint(renderer, (int)(centreX + x), (int)(centreY + y));
-		SDL_RenderDrawPoint(renderer, (int)(centreX - x), (int)(centreY - y));
-		SDL_RenderDrawPoint(renderer, (int)(centreX - x), (int)(centreY + y));
-		SDL_RenderDrawPoint(renderer, (int)(centreX + y), (int)(centreY - x));
-		SDL_RenderDrawPoint(renderer, (int)(centreX + y), (int)(centreY + x));
-		SDL_RenderDrawPoint(renderer, (int)(centreX - y), (int)(centreY - x));
-		SDL_RenderDrawPoint(renderer, (int)(centreX - y), (int)(centreY + x));
+template <class Narrowphase, class Response, class Axis>
+void Game::findPairs(NeighborListBroadphase) {
+	// Most frames only the narrowphase runs, over the pairs listed at the last rebuild
+	if (neighborList.isStale(objects)) neighborList.build(objects, staticBVH);
+	for (auto& pair : neighborList.movingPairs()) {
+		resolve<Narrowphase, Response>(*pair.first, *pair.second);
+	}
+	for (auto& pair : neighborList.staticPairs()) {	// Walls are never tinted
+		resolve<Narrowphase, BounceResponse<Response::recordContacts, false>>(*pair.first, *pair.second);
+	}
+}
 
-		if (error <= 0)
-		{
-			++y;
-			error += ty;
-			ty += 2;
-		}
+template <class Narrowphase, class Response, class Axis, bool ChooseAxis>
+void Game::sweepAndPrune() {
+	refreshFatBoxes();	// Only objects that left their fat box change their key, so only they move in the sort
+	sortObjects<Axis>();
 
-		if (error > 0)
-		{
-			--x;
-			tx += 2;
-			error += (tx - diameter);
+	// The sorted objects are split into ranges with about as many candidates each, and every range is swept on its own thread
+	// into its own pair list (reading on into the next range as far as its boxes reach). Resolving the lists in range order
+	// handles the pairs in the same order one thread sweeping everything would have
+	size_t chunks = parallelChunks(objects.size(), SWEEP_MIN_CHUNK_SIZE);
+	if (chunks == 0) return;
+	splitSweep<Axis>(chunks);
+	auto resolvePair = [&](size_t i, size_t j) {
+		objects[i]->lastOverlapFrame = totalFrames;
+		objects[j]->lastOverlapFrame = totalFrames;
+		resolve<Narrowphase, Response>(*objects[i], *objects[j]);
+	};
+	if (chunks == 1) {	// One thread resolves right away instead of going through a pair list
+		sweepChunks[0].pairs.clear();
+		sweepRange<Axis, ChooseAxis>(sweepChunks[0], 0, objects.size(), resolvePair);
+	}
+	else {
+		parallelFor(chunks, 1, [&](size_t first, size_t last, size_t) {
+			for (size_t chunk = first; chunk < last; chunk++) {
+				std::vector<std::pair<uint32_t, uint32_t>>& pairs = sweepChunks[chunk].pairs;
+				pairs.clear();
+				sweepRange<Axis, ChooseAxis>(sweepChunks[chunk], sweepBounds[chunk], sweepBounds[chunk + 1],
+					[&](size_t i, size_t j) { pairs.emplace_back((uint32_t)i, (uint32_t)j); });
+			}
+		});
+	}
+
+	float minX = std::numeric_limits<float>::infinity();	// For variance based sweep and prune
+	float maxX = 0;
+	float minY = std::numeric_limits<float>::infinity();
+	float maxY = 0;
+	for (size_t chunk = 0; chunk < chunks; chunk++) {
+		const SweepChunk& found = sweepChunks[chunk];
+		if (ChooseAxis) {
+			minX = std::min(minX, found.minX);
+			maxX = std::max(maxX, found.maxX);
+			minY = std::min(minY, found.minY);
+			maxY = std::max(maxY, found.maxY);
+		}
+		for (auto& pair : found.pairs) {
+			resolvePair(pair.first, pair.second);
 		}
 	}
+	if (ChooseAxis) {
+		sortAxis = (maxX - minX >= maxY - minY) ? 'x' : 'y';
+	}
 }
 
-bool Game::cmpAABBPositions(const Object* a, const Object* b) {	// For sorting the AABB objects
-	float minA, minB;
-	if (sortAxis == 'x') {
-		minA = a->AABB->min().x;
-		minB = b->AABB->min().x;
+template <class Axis>
+void Game::splitSweep(size_t chunks) {
+	if (sweepChunks.size() < chunks) sweepChunks.resize(chunks);
+	sweepBounds.assign(chunks + 1, objects.size());
+	sweepBounds[0] = 0;
+	if (chunks == 1) return;
+
+	// How far a sampled object's sweep reaches, found by galloping ahead over the sorted mins, stands in for the objects around it
+	size_t samples = (objects.size() + SWEEP_SAMPLE_STRIDE - 1) / SWEEP_SAMPLE_STRIDE;
+	std::vector<size_t>& work = sweepWork;
+	work.resize(samples + 1);
+	work[0] = 0;
+	for (size_t s = 0; s < samples; s++) {
+		size_t i = s * SWEEP_SAMPLE_STRIDE;
+		int end = Axis::max(sortedBoxes[i]);
+		size_t step = 1, reach = i;	// Objects (i, reach] start before i ends
+		while (reach + step < objects.size() && Axis::min(sortedBoxes[reach + step]) <= end) {
+			reach += step;
+			step *= 2;
+		}
+		for (; step > 0; step /= 2) {
+			if (reach + step < objects.size() && Axis::min(sortedBoxes[reach + step]) <= end) reach += step;
+		}
+		work[s + 1] = work[s] + (reach - i + 1) * SWEEP_SAMPLE_STRIDE;	// Running total
+	}
+	size_t chunk = 1;
+	for (size_t s = 1; s < samples && chunk < chunks; s++) {
+		if (work[s] * chunks >= work[samples] * chunk) sweepBounds[chunk++] = s * SWEEP_SAMPLE_STRIDE;
+	}
+	for (; chunk < chunks; chunk++) {	// Everything was in the first few samples, the chunks left over get nothing
+		sweepBounds[chunk] = objects.size();
 	}
-	else {	// sortAxis is y
-		minA = a->AABB->min().y;
-		minB = b->AABB->min().y;
+}
+
+template <class Axis, bool ChooseAxis, class Found>
+void Game::sweepRange(SweepChunk& chunk, size_t begin, size_t end, Found found) {
+	// Objects are sorted by where their fat box starts along Axis, so every object after i that starts before i ends overlaps
+	// it along Axis, and the first one that starts after it ends finishes i
+	chunk.minX = std::numeric_limits<float>::infinity();
+	chunk.maxX = 0;
+	chunk.minY = std::numeric_limits<float>::infinity();
+	chunk.maxY = 0;
+	for (size_t i = begin; i < end; i++) {
+		Object* object = objects[i];
+		if (ChooseAxis) {	// Recording the maximums and minimums for the calculation of variance
+			chunk.minX = std::min(chunk.minX, AxisX::min(object));
+			chunk.maxX = std::max(chunk.maxX, AxisX::max(object));
+			chunk.minY = std::min(chunk.minY, AxisY::min(object));
+			chunk.maxY = std::max(chunk.maxY, AxisY::max(object));
+		}
+		QuantizedBox query = queryBox(sortedBoxes[i]);
+		int last = Axis::max(sortedBoxes[i]);
+		for (size_t j = i + 1; j < objects.size(); j++) {	// Only looking at objects after the 'i'th object as to not waste time
+			if (Axis::min(sortedBoxes[j]) > last) break;
+			if (!boxesOverlap(sortedBoxes[j], query)) continue;	// Apart along the other axis, objects[j] isn't even loaded
+			if (!shouldCollide(object->filter, objects[j]->filter)) continue;
+			found(i, j);
+		}
 	}
-	return (minA < minB);
 }
 
-int Game::AABBOverlap(Object* a, Object* b) {
-	float minA, maxA, minB, maxB;
-	if (sortAxis == 'x') {
-		minA = a->AABB->min().x;
-		maxA = a->AABB->max().x;
-		minB = b->AABB->min().x;
-		maxB = b->AABB->max().x;
+template <class Axis>
+void Game::sortObjects() {
+	MinAlong<Axis> less;
+	bool sorted = false;
+	if (sortedAxis == Axis::name) {
+		// Objects only moved a little since last frame, so an insertion sort is close to linear.
+		// If things moved too much it gives up and the rest is left to a full sort.
+		size_t budget = objects.size() * 8;
+		for (size_t i = 1; i < objects.size() && budget > 0; i++) {
+			Object* object = objects[i];
+			size_t j = i;
+			for (; j > 0 && less(object, objects[j - 1]) && budget > 0; j--, budget--) {
+				objects[j] = objects[j - 1];
+			}
+			objects[j] = object;
+		}
+		sorted = (budget > 0);
 	}
-	else {	// sortAxis == 'y'
-		minA = a->AABB->min().y;
-		maxA = a->AABB->max().y;
-		minB = b->AABB->min().y;
-		maxB = b->AABB->max().y;
+	if (!sorted) {
+		parallelStableSort(objects, sortScratch, SWEEP_MIN_CHUNK_SIZE, less);	// Stable like the insertion sort, so ties end up the same either way
+		sortedAxis = Axis::name;
 	}
-	if (maxA >= minB && maxB >= minA) {
-		a->lastOverlapFrame = totalFrames;
-		b->lastOverlapFrame = totalFrames;
-		return 1;
+
+	// Remembering the sorted order for spatial queries, and the boxes in that order for the sweep
+	//	Quantizing keeps the boxes in order, floor and ceil never swap two values that were already ordered
+	sortedMins.resize(objects.size());
+	sortedBoxes.resize(objects.size());
+	size_t chunks = parallelChunks(objects.size(), SWEEP_MIN_CHUNK_SIZE);
+	if (sweepChunks.size() < chunks) sweepChunks.resize(chunks);
+	parallelFor(objects.size(), SWEEP_MIN_CHUNK_SIZE, [&](size_t begin, size_t end, size_t chunk) {
+		float extent = 0;
+		for (size_t i = begin; i < end; i++) {
+			const FatBox& box = objects[i]->fatBox;
+			sortedMins[i] = Axis::min(box);
+			extent = std::max(extent, Axis::max(box) - sortedMins[i]);
+			sortedBoxes[i] = worldQuantizer.quantize(box.minX, box.minY, box.maxX, box.maxY);
+		}
+		sweepChunks[chunk].maxExtent = extent;
+	});
+	maxSortedExtent = 0;
+	for (size_t chunk = 0; chunk < chunks; chunk++) {
+		maxSortedExtent = std::max(maxSortedExtent, sweepChunks[chunk].maxExtent);
 	}
-	return 0;
 }
 
-int Game::boundingCircleCollision(Object& a, Object& b) {
-	vector d = a.pos - b.pos;	// Distance between centers
-	float dist2 = d.dot(d);		// This is just d^2
-	float radiusSum = a.radius + b.radius;
-	if (dist2 <= radiusSum * radiusSum) {
-		a.lastCollisionFrame = totalFrames;
-		b.lastCollisionFrame = totalFrames;
-		return true;	// is d^2 <= radiusSum^2?
+template <class Narrowphase, class Response>
+void Game::collideWithStatic() {
+	staticFound.reserve(staticObjects.size());	// Room for any query up front, instead of growing whenever a crowd of walls is hit
+	for (size_t i = 0; i < objects.size(); i++) {
+		Object* object = objects[i];
+		vector min = object->pos - vector(object->radius, object->radius);	// Circle mode objects have no AABB
+		vector max = object->pos + vector(object->radius, object->radius);
+		staticFound.clear();
+		staticBVH.query(min, max, staticFound);
+		for (auto wall : staticFound) {
+			if (!shouldCollide(object->filter, wall->filter)) continue;
+			resolve<Narrowphase, Response>(*object, *wall);
+		}
 	}
-	return false;
 }
 
-int Game::AABBCollision(Object& a, Object& b) {
-	const vector* aCenter = a.AABB->center;
-	const float* aRadi = a.AABB->radi;
-	const vector* bCenter = b.AABB->center;
-	const float* bRadi = b.AABB->radi;
-	if (abs(aCenter->x - bCenter->x) > (aRadi[0] + bRadi[0])) return 0;
-	if (abs(aCenter->y - bCenter->y) > (aRadi[1] + bRadi[1])) return 0;
+template <class Broadphase, class Narrowphase, bool Recolor>
+void Game::selectPasses() {
+	typedef typename std::conditional<SortsAlongAxis<Broadphase>::value, AxisY, AxisX>::type SecondAxis;	// Broadphases that don't sort get one version
+	if (FLAG_IS_SET(CONTACT_EVENTS)) {
+		collisionPasses[0] = &Game::collide<Broadphase, Narrowphase, BounceResponse<true, Recolor>, AxisX>;
+		collisionPasses[1] = &Game::collide<Broadphase, Narrowphase, BounceResponse<true, Recolor>, SecondAxis>;
+	}
+	else {
+		collisionPasses[0] = &Game::collide<Broadphase, Narrowphase, BounceResponse<false, Recolor>, AxisX>;
+		collisionPasses[1] = &Game::collide<Broadphase, Narrowphase, BounceResponse<false, Recolor>, SecondAxis>;
+	}
+}
 
-	a.lastCollisionFrame = totalFrames;
-	b.lastCollisionFrame = totalFrames;
-	return 1;
+void Game::selectPipeline() {
+	// The flags are tested here once instead of inside the loops every frame
+	if (BRUTE_FORCE_CIRCLE & flags) selectPasses<BruteForceBroadphase, CircleNarrowphase, true>();
+	else if (BRUTE_FORCE_AABB & flags) selectPasses<BruteForceBroadphase, AABBNarrowphase, true>();
+	else if (FLAG_IS_SET(SWEEP_AND_PRUNE_AABB)) selectPasses<SweepAndPruneBroadphase, AABBNarrowphase, false>();
+	else if (FLAG_IS_SET(VARIANCE_SWEEP_AND_PRUNE_AABB)) selectPasses<VarianceSweepAndPruneBroadphase, AABBNarrowphase, false>();
+	else if (FLAG_IS_SET(UNIFORM_GRID_AABB)) selectPasses<UniformGridBroadphase, AABBNarrowphase, false>();
+	else if (FLAG_IS_SET(LINEAR_BVH_AABB)) selectPasses<LinearBVHBroadphase, AABBNarrowphase, false>();
+	else if (FLAG_IS_SET(NEIGHBOR_LIST_AABB)) selectPasses<NeighborListBroadphase, AABBNarrowphase, false>();
+	else selectPasses<NoBroadphase, CircleNarrowphase, false>();	// Without AABBs only circles can be tested
 }
 
 int Game::isColliding(Object* object) {
-	return (object->lastCollisionFrame == totalFrames);
+	return (object->lastCollisionFrame == (uint32_t)totalFrames);
 }
 
 int Game::isOverlapping(Object* object) {
-	return (object->lastOverlapFrame == totalFrames);
+	return (object->lastOverlapFrame == (uint32_t)totalFrames);
 }
 
 int Game::render() {
+	AllocationScope scope(ALLOCATION_RENDERING);
+	if (FLAG_IS_SET(PIPELINED_RENDER) && !simulationThread.joinable()) simulationThread = std::thread(&Game::simulate, this);
+	if (FLAG_IS_SET(HEADLESS)) return 0;
+	if (!FLAG_IS_SET(PIPELINED_RENDER)) publishRenderState();	// Serially, the frame that just ran goes straight through
+	if (!renderStates.acquire()) {	// The simulation hasn't finished a frame since the last one was drawn
+		SDL_Delay(1);
+		return 0;
+	}
+	drawRenderState(renderStates.readBuffer());
+	return 0;
+}
+
+void Game::publishRenderState() {
+	fillRenderState(renderStates.writeBuffer());
+	renderStates.publish();
+}
+
+void Game::fillRenderState(RenderState& state) {
+	state.frame = totalFrames;
+	state.camera = getCamera();
+	state.width = windowWidth;
+	state.height = windowHeight;
+	state.items.clear();	// Keeps its capacity, so this stops allocating once the view stops growing
+	state.tiles.clear();
+	float zoom = state.camera.zoom;
+
+	// Culling, a view that takes in the whole world skips the query
+	vector viewMin(state.camera.x - windowWidth / (2 * zoom), state.camera.y - windowHeight / (2 * zoom));
+	vector viewMax(state.camera.x + windowWidth / (2 * zoom), state.camera.y + windowHeight / (2 * zoom));
+	visibleObjects.clear();
+	if (viewMin.x <= 0 && viewMin.y <= 0 && viewMax.x >= windowWidth && viewMax.y >= windowHeight) {
+		visibleObjects.insert(visibleObjects.end(), objects.begin(), objects.end());
+		visibleObjects.insert(visibleObjects.end(), staticObjects.begin(), staticObjects.end());
+	}
+	else {
+		queryRegion(viewMin, viewMax, visibleObjects);
+	}
+
+	// Level of detail, first how crowded every tile is and then which objects go into their tile. Only zoomed out, at one to
+	// one or closer every object is drawn as itself
+	bool foldTiles = zoom < 1;
+	int columns = (windowWidth + LOD_TILE_PIXELS - 1) / LOD_TILE_PIXELS;
+	int rows = (windowHeight + LOD_TILE_PIXELS - 1) / LOD_TILE_PIXELS;
+	float tileArea = (float)(LOD_TILE_PIXELS * LOD_TILE_PIXELS);
+	LodTile empty = {};
+	lodTiles.assign(columns * rows, empty);
+	objectTiles.resize(visibleObjects.size());
+	for (size_t i = 0; i < visibleObjects.size(); i++) {
+		Object* object = visibleObjects[i];
+		int column = std::min(std::max((int)((object->pos.x - viewMin.x) * zoom) / LOD_TILE_PIXELS, 0), columns - 1);
+		int row = std::min(std::max((int)((object->pos.y - viewMin.y) * zoom) / LOD_TILE_PIXELS, 0), rows - 1);
+		float screenRadius = object->radius * zoom;
+		objectTiles[i] = row * columns + column;
+		lodTiles[objectTiles[i]].coverage += std::min(3.14159265f * screenRadius * screenRadius / tileArea, 1.0f);	// An object bigger than its tile doesn't crowd it by itself
+	}
+
+	bool drawColliders = FLAG_IS_SET(RENDER_COLLIDERS) && (FLAG_IS_SET(BRUTE_FORCE_AABB) || FLAG_IS_SET(SWEEP_AND_PRUNE_AABB) || FLAG_IS_SET(LINEAR_BVH_AABB) || FLAG_IS_SET(NEIGHBOR_LIST_AABB));
+	for (size_t i = 0; i < visibleObjects.size(); i++) {
+		Object* object = visibleObjects[i];
+		LodTile& tile = lodTiles[objectTiles[i]];
+		float screenRadius = object->radius * zoom;
+		if (foldTiles && (screenRadius < LOD_MIN_RADIUS || tile.coverage > LOD_MAX_COVERAGE)) {
+			tile.aggregated += std::min(3.14159265f * screenRadius * screenRadius / tileArea, 1.0f);
+			tile.r += object->color.r;
+			tile.g += object->color.g;
+			tile.b += object->color.b;
+			tile.count++;
+			continue;
+		}
+		state.items.push_back(RenderItem());
+		RenderItem& item = state.items.back();
+		item.x = object->pos.x;
+		item.y = object->pos.y;
+		item.radius = object->radius;
+		item.color = object->color;
+		item.isCircle = object->isCircle;
+		item.collider = RENDER_NO_COLLIDER;
+		if (drawColliders && object->isCircle && !object->isStatic) {	// The colors are picked when drawing, so setColliderColor doesn't race with the simulation
+			item.halfWidth = object->AABB->radi[0];
+			item.halfHeight = object->AABB->radi[1];
+			if (isColliding(object)) item.collider = RENDER_COLLIDING;
+			else if (isOverlapping(object)) item.collider = RENDER_OVERLAPPING;
+			else item.collider = RENDER_COLLIDER;
+		}
+	}
+	for (int i = 0; i < columns * rows; i++) {
+		const LodTile& tile = lodTiles[i];
+		if (tile.count == 0) continue;
+		RenderTile renderTile;
+		renderTile.rect.x = (i % columns) * LOD_TILE_PIXELS;
+		renderTile.rect.y = (i / columns) * LOD_TILE_PIXELS;
+		renderTile.rect.w = LOD_TILE_PIXELS;
+		renderTile.rect.h = LOD_TILE_PIXELS;
+		renderTile.color.r = (unsigned char)(tile.r / tile.count);
+		renderTile.color.g = (unsigned char)(tile.g / tile.count);
+		renderTile.color.b = (unsigned char)(tile.b / tile.count);
+		renderTile.color.a = (unsigned char)(255 * std::min(std::max(tile.aggregated, LOD_MIN_ALPHA), 1.0f));
+		state.tiles.push_back(renderTile);
+	}
+}
+
+void Game::setCamera(const Camera& camera) {
+	std::lock_guard<std::mutex> lock(cameraLock);
+	this->camera = camera;
+	this->camera.zoom = std::max(camera.zoom, 1e-3f);
+}
+
+Camera Game::getCamera() {
+	std::lock_guard<std::mutex> lock(cameraLock);
+	return camera;
+}
+
+void Game::setNeighborSkin(float skin) {
+	neighborList.setSkin(skin);
+}
+
+size_t Game::getNeighborListRebuilds() {
+	return neighborList.getRebuilds();
+}
+
+int Game::getBroadphase() {
+	return flags & BROADPHASE_FLAGS;
+}
+
+size_t Game::getBroadphaseSwitches() {
+	return broadphaseSelector.getSwitches();
+}
+
+void Game::chooseBroadphase() {
+	if (replayWriter.isOpen() || replayedFrames < replayReader.frameCount()) return;
+	if (broadphaseSelector.update(objects, (uint32_t)totalFrames, maxDisplacement, lastCollisionMs)) {
+		switchBroadphase(ADAPTIVE_BROADPHASES[broadphaseSelector.current()]);
+	}
+}
+
+void Game::switchBroadphase(int broadphase) {
+	flags = (flags & ~BROADPHASE_FLAGS) | broadphase;
+	selectPipeline();
+
+	// What the old broadphase kept would be out of date by the time it is picked again, the new one builds from scratch
+	resetFatBoxes();	// Also empties the grid
+	sortedAxis = 0;
+	neighborList.invalidate();
+	settledFrames = 0;
+}
+
+void Game::setStorageReorderInterval(int frames) {
+	reorderInterval = frames;
+}
+
+size_t Game::getStorageReorders() {
+	return storageReorders;
+}
+
+void Game::drawRenderState(const RenderState& state) {
 	SDL_SetRenderDrawColor(renderer, backgroundColor.r, backgroundColor.g, backgroundColor.b, backgroundColor.a);
 	SDL_RenderClear(renderer);
 	if (DEBUG_RENDERER & flags) {
 		std::cout << "Rendering to the Screen!" << std::endl;
-		std::cout << "Number of Objects in object vector = " << objects.size() << std::endl;
-	}
-
-	for (auto i = 0; i < objects.size(); i++) {
-		if (DEBUG_RENDERER & flags) std::cout << "\tDrawing object " << i << std::endl;
-		if (DEBUG_RENDERER & flags) printf("\t\tColor = (%d, %d, %d, %d)\n", objects[i]->color.r, objects[i]->color.g, objects[i]->color.b, objects[i]->color.a);
-		if (DEBUG_RENDERER & flags) printf("\t\tCoordinate = (%f, %f)\n", objects[i]->pos.x, objects[i]->pos.y);
-		if (FLAG_IS_SET(DEBUG_RENDERER | BRUTE_FORCE_AABB)) printf("\t\tCoordinateAABB = (%f, %f)\n", objects[i]->AABB->center->x, objects[i]->AABB->center->y);
-		if (objects[i]->isCircle) {	// Is the object just a point or a circle?
-			// Draw circle
-			SDL_SetRenderDrawColor(renderer, objects[i]->color.r, objects[i]->color.g, objects[i]->color.b, objects[i]->color.a);
-			DrawCircle(renderer, *objects[i]);
-			
-			// Drawing colliders
-			if (FLAG_IS_SET(RENDER_COLLIDERS)) {
-				if (FLAG_IS_SET(BRUTE_FORCE_AABB) || FLAG_IS_SET(SWEEP_AND_PRUNE_AABB)) {
-					if (isColliding(objects[i])) {
-						SDL_SetRenderDrawColor(renderer, collisionColor.r, collisionColor.g, collisionColor.b, collisionColor.a);	// Change color to red if colliding
-					}
-					else if (isOverlapping(objects[i])) {
-						SDL_SetRenderDrawColor(renderer, overlapColor.r, overlapColor.g, overlapColor.b, overlapColor.a);	// Change color to light blue if overlapping
-					}
-					else {
-						SDL_SetRenderDrawColor(renderer, colliderColor.r, colliderColor.g, colliderColor.b, colliderColor.a); // Change color to default color for no collisions or overlap
-					}
-					SDL_RenderDrawPoint(renderer, (int)objects[i]->AABB->center->x, (int)objects[i]->AABB->center->y);	// Drawing the center of the collider
-					SDL_Rect collider = objects[i]->AABB->toSDLRect();
-					SDL_RenderDrawRect(renderer, &collider);
-				}
-			}
-		}
-		else {
-			// Draw point
-			SDL_SetRenderDrawColor(renderer, objects[i]->color.r, objects[i]->color.g, objects[i]->color.b, objects[i]->color.a); // Drawing a point
-			SDL_RenderDrawPoint(renderer, (int)objects[i]->pos.x, (int)objects[i]->pos.y);
+		std::cout << "Number of Objects in frame " << state.frame << " = " << state.items.size() << " and " << state.tiles.size() << " tiles" << std::endl;
+		for (size_t i = 0; i < state.items.size(); i++) {
+			const RenderItem& item = state.items[i];
+			std::cout << "\tDrawing object " << i << std::endl;
+			printf("\t\tColor = (%d, %d, %d, %d)\n", item.color.r, item.color.g, item.color.b, item.color.a);
+			printf("\t\tCoordinate = (%f, %f)\n", item.x, item.y);
 		}
 	}
 
+	// Everything is batched and drawn together at the end, so the number of draw calls doesn't grow with the objects
+	drawFrame(state, palette(), batchRenderer);
+	int drawCalls = batchRenderer.flush(renderer);
+	if (DEBUG_RENDERER & flags) std::cout << "Draw calls = " << drawCalls << std::endl;
 	SDL_RenderPresent(renderer);
-	return 0;
+}
+
+RenderPalette Game::palette() {
+	RenderPalette palette;
+	palette.background = backgroundColor;
+	palette.collider = colliderColor;
+	palette.collision = collisionColor;
+	palette.overlap = overlapColor;
+	return palette;
 }
 
 void Game::setBackgroundColor(unsigned char r, unsigned char g, unsigned char b, unsigned char a) {
@@ -451,6 +1134,572 @@ void Game::setColliderColor(unsigned char r, unsigned char g, unsigned char b, u
 	colliderColor.a = a;
 }
 
+void Game::gatherCandidates(const vector& min, const vector& max, std::vector<Object*>& candidates) {
+	vector slack(maxDisplacement, maxDisplacement);
+	vector lo = vector(min.x, min.y) - slack;
+	vector hi = vector(max.x, max.y) + slack;
+	size_t start = candidates.size();
+	if (broadphaseFrame == 0 || (BRUTE_FORCE_CIRCLE & flags) || (BRUTE_FORCE_AABB & flags)) {	// Nothing to search through
+		candidates.insert(candidates.end(), objects.begin(), objects.end());
+	}
+	else if (FLAG_IS_SET(SWEEP_AND_PRUNE_AABB) || FLAG_IS_SET(VARIANCE_SWEEP_AND_PRUNE_AABB)) {
+		// Objects are sorted by their min along sortedAxis, so only a slice of them can reach the query
+		float queryMin = (sortedAxis == 'x') ? lo.x : lo.y;
+		float queryMax = (sortedAxis == 'x') ? hi.x : hi.y;
+		auto first = std::lower_bound(sortedMins.begin(), sortedMins.end(), queryMin - maxSortedExtent);
+		auto last = std::upper_bound(first, sortedMins.end(), queryMax);
+		candidates.insert(candidates.end(), objects.begin() + (first - sortedMins.begin()), objects.begin() + (last - sortedMins.begin()));
+	}
+	else if (FLAG_IS_SET(UNIFORM_GRID_AABB)) {
+		uniformGrid.queryRegion(lo, hi, candidates);
+		std::sort(candidates.begin() + start, candidates.end());	// Objects in several cells came up more than once
+		candidates.erase(std::unique(candidates.begin() + start, candidates.end()), candidates.end());
+	}
+	else if (FLAG_IS_SET(LINEAR_BVH_AABB)) {
+		linearBVH.queryRegion(lo, hi, candidates);
+	}
+	else {
+		candidates.insert(candidates.end(), objects.begin(), objects.end());
+	}
+}
+
+void Game::queryRegion(const vector& min, const vector& max, std::vector<Object*>& found) {
+	size_t start = found.size();
+	gatherCandidates(min, max, found);
+	staticBVH.query(min, max, found);	// Static objects never move, so no slack is needed
+	size_t kept = start;
+	for (size_t i = start; i < found.size(); i++) {	// Keeping the candidates that really overlap right now
+		Object* object = found[i];
+		if (object->pos.x + object->radius < min.x || object->pos.x - object->radius > max.x) continue;
+		if (object->pos.y + object->radius < min.y || object->pos.y - object->radius > max.y) continue;
+		found[kept++] = object;
+	}
+	found.resize(kept);
+}
+
+void Game::queryPoint(const vector& point, std::vector<Object*>& found) {
+	size_t start = found.size();
+	queryRegion(point, point, found);
+	size_t kept = start;
+	for (size_t i = start; i < found.size(); i++) {
+		Object* object = found[i];
+		vector d = object->pos - point;
+		if (object->isCircle && d.dot(d) > object->radius * object->radius) continue;	// Inside the bounds but outside the circle
+		found[kept++] = object;
+	}
+	found.resize(kept);
+}
+
+void Game::queryRadius(const vector& center, float radius, std::vector<Object*>& found) {
+	size_t start = found.size();
+	queryRegion(vector(center.x - radius, center.y - radius), vector(center.x + radius, center.y + radius), found);
+	size_t kept = start;
+	for (size_t i = start; i < found.size(); i++) {
+		Object* object = found[i];
+		vector d = object->pos - center;
+		float reach = radius + object->radius;
+		if (d.dot(d) > reach * reach) continue;
+		found[kept++] = object;
+	}
+	found.resize(kept);
+}
+
+void Game::queryNearest(const vector& point, size_t k, std::vector<Object*>& found) {
+	size_t total = objects.size() + staticObjects.size();
+	if (k == 0 || total == 0) return;
+	k = std::min(k, total);
+
+	// Starting with the radius that would hold k objects if they were spread evenly, doubling it until there are enough.
+	// queryRadius also finds objects whose center is outside the circle, so enough means the k-th closest center is inside
+	// it, every object that wasn't found is farther away than that
+	auto closer = [&](Object* a, Object* b) {
+		vector da = a->pos - point;
+		vector db = b->pos - point;
+		return da.dot(da) < db.dot(db);
+	};
+	std::vector<Object*> candidates;
+	float radius = std::sqrt(k * (float)windowWidth * windowHeight / (3.14159265f * total));
+	float limit = 2.0f * (windowWidth + windowHeight);	// Everything is closer than this, unless it left the screen
+	while (true) {
+		candidates.clear();
+		if (radius > limit) {	// Some objects are far away, so just take everything
+			candidates.assign(objects.begin(), objects.end());
+			candidates.insert(candidates.end(), staticObjects.begin(), staticObjects.end());
+			std::partial_sort(candidates.begin(), candidates.begin() + k, candidates.end(), closer);
+			break;
+		}
+		queryRadius(point, radius, candidates);
+		if (candidates.size() >= k) {
+			std::partial_sort(candidates.begin(), candidates.begin() + k, candidates.end(), closer);
+			vector d = candidates[k - 1]->pos - point;
+			if (d.dot(d) <= radius * radius) break;
+		}
+		radius *= 2;
+	}
+	found.insert(found.end(), candidates.begin(), candidates.begin() + k);
+}
+
+void Game::queryRegionBatch(const std::vector<RegionQuery>& queries, std::vector<size_t>& offsets, std::vector<Object*>& found) {
+	size_t n = queries.size();
+	offsets.assign(n + 1, found.size());
+	if (n == 0) return;
+
+	// Answering the queries in Morton order, so queries next to each other touch the same parts of the broadphase
+	std::vector<std::pair<unsigned int, unsigned int>> order(n);
+	float scaleX = 65535.0f / windowWidth;
+	float scaleY = 65535.0f / windowHeight;
+	for (size_t i = 0; i < n; i++) {
+		float x = std::min(std::max((queries[i].min.x + queries[i].max.x) * 0.5f * scaleX, 0.0f), 65535.0f);
+		float y = std::min(std::max((queries[i].min.y + queries[i].max.y) * 0.5f * scaleY, 0.0f), 65535.0f);
+		order[i] = std::make_pair(mortonCode((unsigned int)x, (unsigned int)y), (unsigned int)i);
+	}
+	std::sort(order.begin(), order.end());
+
+	// Each chunk answers its queries into its own buffer
+	size_t chunks = parallelChunks(n, 64);
+	std::vector<std::vector<Object*>> chunkResults(chunks);
+	std::vector<size_t> starts(n), counts(n);
+	parallelFor(n, 64, [&](size_t begin, size_t end, size_t chunk) {
+		std::vector<Object*>& results = chunkResults[chunk];
+		for (size_t i = begin; i < end; i++) {
+			unsigned int query = order[i].second;
+			starts[query] = results.size();
+			queryRegion(queries[query].min, queries[query].max, results);
+			counts[query] = results.size() - starts[query];
+		}
+	});
+
+	// Laying the results out in query order
+	for (size_t i = 0; i < n; i++) {
+		offsets[i + 1] = offsets[i] + counts[i];
+	}
+	found.resize(offsets[n]);
+	parallelFor(n, 64, [&](size_t begin, size_t end, size_t chunk) {
+		const std::vector<Object*>& results = chunkResults[chunk];
+		for (size_t i = begin; i < end; i++) {
+			unsigned int query = order[i].second;
+			std::copy(results.begin() + starts[query], results.begin() + starts[query] + counts[query], found.begin() + offsets[query]);
+		}
+	});
+}
+
+void Game::castThroughBroadphase(RaycastCollector& collector) {
+	if (broadphaseFrame != 0 && FLAG_IS_SET(UNIFORM_GRID_AABB)) {
+		uniformGrid.raycast(collector, maxDisplacement);
+		return;
+	}
+	if (broadphaseFrame != 0 && FLAG_IS_SET(LINEAR_BVH_AABB)) {
+		linearBVH.raycast(collector, maxDisplacement);
+		return;
+	}
+
+	// The other modes have nothing to walk along a ray, so the candidates are everything in the ray's bounding box
+	const Ray& ray = collector.ray;
+	std::vector<Object*> candidates;
+	if (std::isinf(ray.maxT)) {
+		candidates = objects;
+	}
+	else {
+		vector end = vector(ray.origin.x, ray.origin.y) + vector(ray.direction.x, ray.direction.y) * ray.maxT;
+		vector min(std::min(ray.origin.x, end.x), std::min(ray.origin.y, end.y));
+		vector max(std::max(ray.origin.x, end.x), std::max(ray.origin.y, end.y));
+		gatherCandidates(min, max, candidates);
+	}
+	for (auto object : candidates) {
+		collector.test(object);
+	}
+}
+
+int Game::raycast(const Ray& ray, RaycastMode mode, std::vector<RaycastHit>& hits) {
+	RaycastCollector collector(ray, mode, hits);
+	staticBVH.raycast(collector);	// Walls first, they tend to cut rays short
+	castThroughBroadphase(collector);
+	return collector.finish();
+}
+
+int Game::segmentCast(const vector& start, const vector& end, RaycastMode mode, std::vector<RaycastHit>& hits, const CollisionFilter& filter) {
+	Ray ray;
+	ray.origin = start;
+	ray.direction = vector(end.x, end.y) - start;
+	ray.maxT = 1;
+	ray.filter = filter;
+	return raycast(ray, mode, hits);
+}
+
+void Game::raycastBatch(const std::vector<Ray>& rays, RaycastMode mode, std::vector<size_t>& offsets, std::vector<RaycastHit>& hits) {
+	size_t n = rays.size();
+	offsets.assign(n + 1, hits.size());
+	if (n == 0) return;
+
+	// Grouping rays that start close together and point the same way, so each packet of 4 takes a similar path through the trees
+	std::vector<std::pair<unsigned long long, unsigned int>> order(n);
+	float scaleX = 65535.0f / windowWidth;
+	float scaleY = 65535.0f / windowHeight;
+	for (size_t i = 0; i < n; i++) {
+		unsigned long long octant = (rays[i].direction.x < 0 ? 1 : 0) | (rays[i].direction.y < 0 ? 2 : 0);
+		float x = std::min(std::max(rays[i].origin.x * scaleX, 0.0f), 65535.0f);
+		float y = std::min(std::max(rays[i].origin.y * scaleY, 0.0f), 65535.0f);
+		order[i] = std::make_pair((octant << 32) | mortonCode((unsigned int)x, (unsigned int)y), (unsigned int)i);
+	}
+	std::sort(order.begin(), order.end());
+
+	size_t packets = (n + 3) / 4;
+	size_t chunks = parallelChunks(packets, 16);
+	std::vector<std::vector<RaycastHit>> chunkHits(chunks);
+	std::vector<size_t> starts(n), counts(n);
+	parallelFor(packets, 16, [&](size_t begin, size_t end, size_t chunk) {
+		std::vector<RaycastHit>& results = chunkHits[chunk];
+		std::vector<RaycastHit> laneHits[4];
+		std::vector<RaycastCollector> collectors;
+		collectors.reserve(4);
+		for (size_t packet = begin; packet < end; packet++) {
+			int count = (int)std::min((size_t)4, n - packet * 4);
+			Ray packetRays[4];
+			RaycastCollector* lanes[4];
+			collectors.clear();
+			for (int lane = 0; lane < count; lane++) {
+				packetRays[lane] = rays[order[packet * 4 + lane].second];
+				laneHits[lane].clear();
+				collectors.emplace_back(packetRays[lane], mode, laneHits[lane]);
+			}
+			for (int lane = 0; lane < count; lane++) {
+				lanes[lane] = &collectors[lane];
+			}
+
+			// The trees are walked once per packet, the grid and the other modes go ray by ray
+			staticBVH.raycastPacket(packetRays, lanes, count);
+			if (broadphaseFrame != 0 && FLAG_IS_SET(LINEAR_BVH_AABB)) {
+				linearBVH.raycastPacket(packetRays, lanes, count, maxDisplacement);
+			}
+			else {
+				for (int lane = 0; lane < count; lane++) {
+					castThroughBroadphase(collectors[lane]);
+				}
+			}
+			for (int lane = 0; lane < count; lane++) {
+				unsigned int ray = order[packet * 4 + lane].second;
+				collectors[lane].finish();
+				starts[ray] = results.size();
+				counts[ray] = laneHits[lane].size();
+				results.insert(results.end(), laneHits[lane].begin(), laneHits[lane].end());
+			}
+		}
+	});
+
+	// Laying the hits out in ray order
+	for (size_t i = 0; i < n; i++) {
+		offsets[i + 1] = offsets[i] + counts[i];
+	}
+	hits.resize(offsets[n]);
+	parallelFor(packets, 16, [&](size_t begin, size_t end, size_t chunk) {
+		const std::vector<RaycastHit>& results = chunkHits[chunk];
+		for (size_t i = begin * 4; i < std::min(end * 4, n); i++) {
+			unsigned int ray = order[i].second;
+			std::copy(results.begin() + starts[ray], results.begin() + starts[ray] + counts[ray], hits.begin() + offsets[ray]);
+		}
+	});
+}
+
+int Game::saveSnapshot(const char* path) {
+	AllocationScope scope(ALLOCATION_SNAPSHOTS);
+	captureSnapshot();
+	if (!snapshotWriter.begin(path)) return 0;
+	return snapshotWriter.finish();
+}
+
+int Game::beginSnapshot(const char* path) {
+	AllocationScope scope(ALLOCATION_SNAPSHOTS);
+	captureSnapshot();
+	return snapshotWriter.begin(path);
+}
+
+void Game::captureSnapshot() {
+	applySpawnsAndDespawns();	// Queued changes are part of the scene too
+	snapshotWriter.clear();
+	size_t dynamicCount = objects.size();
+	size_t count = dynamicCount + staticObjects.size();
+
+	SnapshotScene* scene = snapshotWriter.addChunk<SnapshotScene>(SNAPSHOT_SCENE, 1);
+	memset(scene, 0, sizeof(SnapshotScene));
+	scene->width = windowWidth;
+	scene->height = windowHeight;
+	scene->flags = flags;
+	scene->sortedAxis = sortedAxis;
+	scene->dynamicCount = dynamicCount;
+	scene->staticCount = staticObjects.size();
+	scene->totalFrames = totalFrames;
+	scene->nextId = id_count;
+	scene->staticRoot = staticBVH.getRoot();
+	scene->sortAxis = sortAxis;
+
+	// Object columns, moving objects first
+	float* positionX = snapshotWriter.addChunk<float>(SNAPSHOT_POSITION_X, count);
+	float* positionY = snapshotWriter.addChunk<float>(SNAPSHOT_POSITION_Y, count);
+	float* velocityX = snapshotWriter.addChunk<float>(SNAPSHOT_VELOCITY_X, count);
+	float* velocityY = snapshotWriter.addChunk<float>(SNAPSHOT_VELOCITY_Y, count);
+	float* accelerationX = snapshotWriter.addChunk<float>(SNAPSHOT_ACCELERATION_X, count);
+	float* accelerationY = snapshotWriter.addChunk<float>(SNAPSHOT_ACCELERATION_Y, count);
+	float* radius = snapshotWriter.addChunk<float>(SNAPSHOT_RADIUS, count);
+	int32_t* mass = snapshotWriter.addChunk<int32_t>(SNAPSHOT_MASS, count);
+	uint32_t* color = snapshotWriter.addChunk<uint32_t>(SNAPSHOT_COLOR, count);
+	uint8_t* state = snapshotWriter.addChunk<uint8_t>(SNAPSHOT_STATE, count);
+	uint64_t* id = snapshotWriter.addChunk<uint64_t>(SNAPSHOT_ID, count);
+	uint32_t* category = snapshotWriter.addChunk<uint32_t>(SNAPSHOT_FILTER_CATEGORY, count);
+	uint32_t* mask = snapshotWriter.addChunk<uint32_t>(SNAPSHOT_FILTER_MASK, count);
+	int32_t* group = snapshotWriter.addChunk<int32_t>(SNAPSHOT_FILTER_GROUP, count);
+	float* halfWidth = snapshotWriter.addChunk<float>(SNAPSHOT_COLLIDER_HALF_WIDTH, count);
+	float* halfHeight = snapshotWriter.addChunk<float>(SNAPSHOT_COLLIDER_HALF_HEIGHT, count);
+	for (size_t i = 0; i < count; i++) {
+		const Object* object = (i < dynamicCount) ? objects[i] : staticObjects[i - dynamicCount];
+		positionX[i] = object->pos.x;
+		positionY[i] = object->pos.y;
+		velocityX[i] = object->vel.x;
+		velocityY[i] = object->vel.y;
+		accelerationX[i] = object->acc.x;
+		accelerationY[i] = object->acc.y;
+		radius[i] = object->radius;
+		mass[i] = object->mass;
+		color[i] = object->color.r | (object->color.g << 8) | (object->color.b << 16) | ((uint32_t)object->color.a << 24);
+		state[i] = (object->isStatic ? SNAPSHOT_STATIC : 0) | (object->isCircle ? SNAPSHOT_CIRCLE : 0) | (object->isVisible ? SNAPSHOT_VISIBLE : 0);
+		id[i] = object->id;
+		category[i] = object->filter.category;
+		mask[i] = object->filter.mask;
+		group[i] = object->filter.group;
+		halfWidth[i] = (object->AABB != NULL) ? object->AABB->radi[0] : object->radius;
+		halfHeight[i] = (object->AABB != NULL) ? object->AABB->radi[1] : object->radius;
+	}
+
+	// The static BVH as it is, items are saved as indices into the static objects
+	const std::vector<StaticBVH::Node>& nodes = staticBVH.getNodes();
+	const std::vector<Object*>& items = staticBVH.getItems();
+	StaticBVH::Node* savedNodes = snapshotWriter.addChunk<StaticBVH::Node>(SNAPSHOT_STATIC_BVH_NODES, nodes.size());
+	std::copy(nodes.begin(), nodes.end(), savedNodes);
+	std::vector<std::pair<Object*, uint32_t>> staticIndex(staticObjects.size());
+	for (size_t i = 0; i < staticObjects.size(); i++) {
+		staticIndex[i] = std::make_pair(staticObjects[i], (uint32_t)i);
+	}
+	std::sort(staticIndex.begin(), staticIndex.end());
+	uint32_t* savedItems = snapshotWriter.addChunk<uint32_t>(SNAPSHOT_STATIC_BVH_ITEMS, items.size());
+	for (size_t i = 0; i < items.size(); i++) {
+		auto found = std::lower_bound(staticIndex.begin(), staticIndex.end(), std::make_pair(items[i], (uint32_t)0));
+		savedItems[i] = (items[i] != NULL && found != staticIndex.end() && found->first == items[i]) ? found->second : SNAPSHOT_NO_ITEM;
+	}
+}
+
+template <typename T>
+static const T* snapshotColumn(const Snapshot& snapshot, uint32_t type, size_t count) {	// NULL unless the column has an entry for every object
+	size_t found;
+	const T* column = snapshot.chunk<T>(type, found);
+	return (found == count) ? column : NULL;
+}
+
+int Game::loadSnapshot(const char* path) {
+	AllocationScope scope(ALLOCATION_SNAPSHOTS);
+	Snapshot snapshot;
+	if (!snapshot.open(path)) return 0;
+	size_t sceneCount;
+	const SnapshotScene* scene = snapshot.chunk<SnapshotScene>(SNAPSHOT_SCENE, sceneCount);
+	if (scene == NULL || sceneCount != 1) return 0;
+	size_t dynamicCount = (size_t)scene->dynamicCount;
+	size_t staticCount = (size_t)scene->staticCount;
+	size_t count = dynamicCount + staticCount;
+
+	// Every column is read in place from the mapping
+	const float* positionX = snapshotColumn<float>(snapshot, SNAPSHOT_POSITION_X, count);
+	const float* positionY = snapshotColumn<float>(snapshot, SNAPSHOT_POSITION_Y, count);
+	const float* velocityX = snapshotColumn<float>(snapshot, SNAPSHOT_VELOCITY_X, count);
+	const float* velocityY = snapshotColumn<float>(snapshot, SNAPSHOT_VELOCITY_Y, count);
+	const float* accelerationX = snapshotColumn<float>(snapshot, SNAPSHOT_ACCELERATION_X, count);
+	const float* accelerationY = snapshotColumn<float>(snapshot, SNAPSHOT_ACCELERATION_Y, count);
+	const float* radius = snapshotColumn<float>(snapshot, SNAPSHOT_RADIUS, count);
+	const int32_t* mass = snapshotColumn<int32_t>(snapshot, SNAPSHOT_MASS, count);
+	const uint32_t* color = snapshotColumn<uint32_t>(snapshot, SNAPSHOT_COLOR, count);
+	const uint8_t* state = snapshotColumn<uint8_t>(snapshot, SNAPSHOT_STATE, count);
+	const uint64_t* id = snapshotColumn<uint64_t>(snapshot, SNAPSHOT_ID, count);
+	const uint32_t* category = snapshotColumn<uint32_t>(snapshot, SNAPSHOT_FILTER_CATEGORY, count);
+	const uint32_t* mask = snapshotColumn<uint32_t>(snapshot, SNAPSHOT_FILTER_MASK, count);
+	const int32_t* group = snapshotColumn<int32_t>(snapshot, SNAPSHOT_FILTER_GROUP, count);
+	const float* halfWidth = snapshotColumn<float>(snapshot, SNAPSHOT_COLLIDER_HALF_WIDTH, count);
+	const float* halfHeight = snapshotColumn<float>(snapshot, SNAPSHOT_COLLIDER_HALF_HEIGHT, count);
+	if (!positionX || !positionY || !velocityX || !velocityY || !accelerationX || !accelerationY || !radius || !mass ||
+		!color || !state || !id || !category || !mask || !group || !halfWidth || !halfHeight) return 0;
+
+	// Throwing the current scene away
+	applySpawnsAndDespawns();
+	for (auto object : objects) {
+		destroyObject(object);
+	}
+	for (auto wall : staticObjects) {
+		destroyObject(wall);
+	}
+	objects.clear();
+	staticObjects.clear();
+	contactCache = ContactCache();
+	broadphaseFrame = 0;
+	sortedMins.clear();
+	sortedBoxes.clear();
+	dirtyObjects.clear();	// The loaded objects have no fat boxes yet, the next update makes them
+	neighborList.invalidate();
+	framesSinceReorder = 0;	// Counted the same way as in the recording, which restarted the count when it began
+	spreadAfterReorder = -1;
+	sortedAxis = 0;
+	settledFrames = 0;
+	if (FLAG_IS_SET(SWEEP_AND_PRUNE_AABB) || FLAG_IS_SET(VARIANCE_SWEEP_AND_PRUNE_AABB)) {	// Moving objects are saved in their sorted order, so the next sort is cheap again
+		sortedAxis = (char)scene->sortedAxis;
+		if (scene->sortAxis == 'x' || scene->sortAxis == 'y') sortAxis = (char)scene->sortAxis;
+	}
+	totalFrames = (size_t)scene->totalFrames;
+
+	objects.reserve(dynamicCount);
+	staticObjects.reserve(staticCount);
+	uint32_t nextId = (uint32_t)scene->nextId;
+	for (size_t i = 0; i < count; i++) {
+		bool isStatic = (i >= dynamicCount);
+		Object* object = createObject(positionX[i], positionY[i], radius[i], isStatic || usesAABB());
+		object->vel = vector(velocityX[i], velocityY[i]);
+		object->acc = vector(accelerationX[i], accelerationY[i]);
+		object->mass = mass[i];
+		object->color = Color(color[i] & 0xff, (color[i] >> 8) & 0xff, (color[i] >> 16) & 0xff, color[i] >> 24);
+		object->isStatic = isStatic;
+		object->isCircle = (state[i] & SNAPSHOT_CIRCLE) != 0;
+		object->isVisible = (state[i] & SNAPSHOT_VISIBLE) != 0;
+		object->id = (uint32_t)id[i];
+		object->filter.category = category[i];
+		object->filter.mask = mask[i];
+		object->filter.group = group[i];
+		if (object->AABB != NULL) {
+			object->AABB->radi[0] = halfWidth[i];
+			object->AABB->radi[1] = halfHeight[i];
+		}
+		nextId = std::max(nextId, object->id + 1);
+		if (isStatic) staticObjects.push_back(object);
+		else objects.push_back(object);
+	}
+	id_count = std::max(id_count, nextId);
+
+	// The saved static BVH is used as long as it fits the static objects, otherwise it is built again
+	size_t nodeCount, itemCount;
+	const StaticBVH::Node* nodes = snapshot.chunk<StaticBVH::Node>(SNAPSHOT_STATIC_BVH_NODES, nodeCount);
+	const uint32_t* items = snapshot.chunk<uint32_t>(SNAPSHOT_STATIC_BVH_ITEMS, itemCount);
+	int root = scene->staticRoot;
+	bool treeFits = (nodes != NULL && items != NULL);	// The tree itself is checked by restore
+	std::vector<Object*> treeItems;
+	if (treeFits) {
+		treeItems.resize(itemCount);
+		for (size_t i = 0; i < itemCount && treeFits; i++) {
+			treeFits = (items[i] == SNAPSHOT_NO_ITEM || items[i] < staticCount);
+			treeItems[i] = (treeFits && items[i] != SNAPSHOT_NO_ITEM) ? staticObjects[items[i]] : NULL;
+		}
+	}
+	if (!treeFits || !staticBVH.restore(nodes, nodeCount, treeItems, root, staticObjects)) staticBVH.build(staticObjects);
+
+	if (FLAG_IS_SET(UNIFORM_GRID_AABB) || FLAG_IS_SET(ADAPTIVE_BROADPHASE)) {	// The cells are sized from the objects, same as in the constructor
+		int cellSize = objects.empty() ? 24 : (int)(4 * (objects[0]->radius + FAT_BOX_MARGIN));
+		uniformGrid = UniformGrid(cellSize, cellSize, windowWidth, windowHeight);
+	}
+	return 1;
+}
+
+int Game::startRecording(const char* path) {
+	AllocationScope scope(ALLOCATION_REPLAYS);
+	stopRecording();
+	std::string snapshotPath = std::string(path) + ".snap";
+	if (!saveSnapshot(snapshotPath.c_str())) return 0;	// This also applies whatever was queued, so the log starts from a clean frame
+	if (!replayWriter.open(path, flags)) return 0;
+	neighborList.invalidate();	// A replay starts without a list or fat boxes, the recording has to rebuild them on the same frame to pair things up in the same order
+	resetFatBoxes();
+	framesSinceReorder = 0;
+	spreadAfterReorder = -1;
+
+	// Replay indices follow the snapshot's order: moving objects, then static ones
+	replayIndices.clear();
+	nextReplayIndex = 0;
+	for (auto object : objects) {
+		replayIndices[object->id] = nextReplayIndex++;
+	}
+	for (auto wall : staticObjects) {
+		replayIndices[wall->id] = nextReplayIndex++;
+	}
+	recordedFrame.clear();
+	return 1;
+}
+
+void Game::stopRecording() {
+	AllocationScope scope(ALLOCATION_REPLAYS);
+	replayWriter.close();
+	replayIndices.clear();
+}
+
+int Game::loadReplay(const char* path) {
+	AllocationScope scope(ALLOCATION_REPLAYS);
+	if (!replayReader.open(path)) return 0;
+	std::string snapshotPath = std::string(path) + ".snap";
+	if (!loadSnapshot(snapshotPath.c_str())) return 0;
+	replayHandles.clear();
+	for (auto object : objects) {
+		replayHandles.push_back(object->handle);
+	}
+	for (auto wall : staticObjects) {
+		replayHandles.push_back(wall->handle);
+	}
+	checkReplay = ((flags & BROADPHASE_FLAGS) == (replayReader.recordedFlags() & BROADPHASE_FLAGS));
+	replayedFrames = 0;
+	replayMismatch = 0;
+	return 1;
+}
+
+int Game::replayFrame() {
+	{
+		AllocationScope scope(ALLOCATION_REPLAYS);
+		if (!replayReader.readFrame(playbackFrame)) return 0;
+	}
+	for (auto index : playbackFrame.despawns) {
+		if (index < replayHandles.size()) despawnObject(replayHandles[index]);
+	}
+	for (auto& spawn : playbackFrame.spawns) {	// Queued in the recorded order, so they are applied in it too
+		Handle handle = spawnObject(spawn.pos.x, spawn.pos.y, spawn.radius, spawn.isStatic);
+		Object* object = getObject(handle);
+		object->vel = spawn.vel;
+		object->acc = spawn.acc;
+		object->mass = spawn.mass;
+		object->color = spawn.color;
+		object->filter = spawn.filter;
+		object->isVisible = spawn.isVisible;
+		replayHandles.push_back(handle);
+	}
+	for (auto& force : playbackFrame.forces) {
+		if (force.index < replayHandles.size()) applyForce(replayHandles[force.index], force.force);
+	}
+	update(playbackFrame.deltaTime);
+	replayedFrames++;
+	if (checkReplay && replayMismatch == 0 && stateChecksum() != playbackFrame.checksum) replayMismatch = replayedFrames;
+	return 1;
+}
+
+size_t Game::getReplayMismatch() {
+	return replayMismatch;
+}
+
+uint64_t Game::stateChecksum() {
+	uint64_t hash = 14695981039346656037ull;	// FNV-1a
+	for (auto object : objects) {
+		float values[4] = { object->pos.x, object->pos.y, object->vel.x, object->vel.y };
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(values);
+		for (size_t i = 0; i < sizeof(values); i++) {
+			hash = (hash ^ bytes[i]) * 1099511628211ull;
+		}
+	}
+	return hash;
+}
+
+const std::vector<ContactEvent>& Game::getContactEvents() {
+	return contactCache.events();
+}
+
+size_t Game::getContactTransitionCount() {
+	return contactCache.transitionCount();
+}
+
 bool Game::isRunning() {
 	return running;
 }
\ No newline at end of file
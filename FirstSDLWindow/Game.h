@@ -4,6 +4,27 @@
 #include "SDL.h"
 #include <chrono>
 #include "UniformGrid.h"
+#include "LinearBVH.h"
+#include "StaticBVH.h"
+#include "Pool.h"
+#include "FrameArena.h"
+#include "ContactCache.h"
+#include "Raycast.h"
+#include "Snapshot.h"
+#include "Replay.h"
+#include "BatchRenderer.h"
+#include "RenderState.h"
+#include "TripleBuffer.h"
+#include "FrameEncoder.h"
+#include "Pipeline.h"
+#include "NeighborList.h"
+#include "BroadphaseSelector.h"
+#include "Allocations.h"
+#include "Parallel.h"
+#include <unordered_map>
+#include <atomic>
+#include <thread>
+#include <mutex>
 
 enum Flags {
 	DEBUG_INPUT						= 1 << 0,
@@ -15,22 +36,122 @@ enum Flags {
 	BRUTE_FORCE_AABB				= 1 << 6,
 	SWEEP_AND_PRUNE_AABB			= 1 << 7,
 	UNIFORM_GRID_AABB				= 1 << 8,
-	VARIANCE_SWEEP_AND_PRUNE_AABB	= 1 << 9
+	VARIANCE_SWEEP_AND_PRUNE_AABB	= 1 << 9,
+	LINEAR_BVH_AABB					= 1 << 10,
+	TEAM_COLLISION_LAYERS			= 1 << 11,	// Splits objects into a red and a blue team that only collide with the other team
+	CONTACT_EVENTS					= 1 << 12,	// Tracks contacts across frames and reports begin/persist/end events
+	HEADLESS						= 1 << 13,	// No window or renderer, for replays and benchmarks
+	PIPELINED_RENDER				= 1 << 14,	// Updates run on their own thread while the calling thread only handles events and renders
+	NEIGHBOR_LIST_AABB				= 1 << 15,	// Candidate pairs come from a Verlet neighbor list that is only rebuilt once objects moved far enough
+	ADAPTIVE_BROADPHASE				= 1 << 16,	// Switches between brute force, sweep and prune, the uniform grid and the linear BVH as the scene changes
+	STRICT_ALLOCATIONS				= 1 << 17	// Stops the game at the first settled frame that allocates, for benchmarks
 };
 
 class Game {
 
 public:
-	Game(const int width, const int height, const int numObjects, const int flags);						// Initializes the screen as well as the initial placements for spawners
+	Game(const int width, const int height, const int numObjects, const int flags, const int numStaticObjects = 0);	// Initializes the screen as well as the initial placements for spawners
 	~Game();
 	int handleEvents();
 	int update();
+	int update(float timestep);					// Steps by timestep seconds instead of the measured frame time
 	void updatePositions();						// Adds the accelerations and velocities to their respective objects
 	void handleCollision(Object& a, Object& b);		// Changes the velocities and accelerations of the two objects to their new directions
 	int render();
 	void setBackgroundColor(unsigned char r, unsigned char g, unsigned char b, unsigned char a);
 	void setColliderColor(unsigned char r, unsigned char g, unsigned char b, unsigned char a);
 	bool isRunning();
+
+	// Pipelined rendering (only with PIPELINED_RENDER)
+	//	The first render starts a simulation thread that calls update in a loop and publishes a RenderState after every frame,
+	//	render draws the newest one. Until then the game can be set up as usual, afterwards only handleEvents, render,
+	//	isRunning, setSimulationRate and setCamera may be called from outside, everything else belongs to the simulation thread.
+	void setSimulationRate(float updatesPerSecond);	// Fixed timesteps at this rate, 0 (the default) updates as fast as possible with measured timesteps
+
+	// Camera
+	//	Only objects in view are drawn, found through the active broadphase. Objects smaller than a pixel on screen or packed
+	//	too densely to make out are drawn as shaded tiles instead, so drawing costs what is visible rather than what exists.
+	void setCamera(const Camera& camera);		// Safe from any thread, takes effect from the next published frame
+	Camera getCamera();
+
+	// Neighbor lists (only with NEIGHBOR_LIST_AABB)
+	//	A bigger skin rebuilds the list less often but makes it longer, it should be a few frames of the fastest object's travel
+	void setNeighborSkin(float skin);			// Distance pairs are listed within, takes effect at the next rebuild
+	size_t getNeighborListRebuilds();			// How many frames had to rebuild the list
+
+	// Storage order
+	//	Moving objects are moved around in memory now and then, so objects close to each other in the scene are close in memory
+	//	too: along a Morton curve, or with sweep and prune in the order it keeps them sorted in. Handles stay valid through it,
+	//	Object pointers only until the next update.
+	void setStorageReorderInterval(int frames);	// Reorders at least this often (0 never reorders), sooner once the order got scattered
+	size_t getStorageReorders();				// How often storage was reordered
+
+	// Adaptive broadphase (only with ADAPTIVE_BROADPHASE, see BroadphaseSelector.h)
+	//	The game starts with the AABB broadphase in its flags (sweep and prune if there is none of the four) and switches at the
+	//	start of an update, so the first pass after a switch builds the new structure. Nothing switches while a replay is
+	//	recorded or played back, the choice depends on timings and would come out differently.
+	int getBroadphase();						// Flag of the broadphase in use
+	size_t getBroadphaseSwitches();
+
+	// Allocation accounting (see Allocations.h)
+	//	A frame runs from the end of one update to the end of the next, so it also counts what happened in between (rendering,
+	//	events, replay input) on any thread. PRINT_METRICS adds the allocations to every framerate line and sums them up by
+	//	subsystem at the end. Only settled frames are held to STRICT_ALLOCATIONS, ones a while after the last spawn, despawn,
+	//	loaded snapshot or broadphase switch, since those leave buffers growing into the new scene for some frames.
+	struct FrameAllocations {
+		AllocationCounters subsystems[ALLOCATION_SUBSYSTEMS];	// Peaks are the most that was live during the frame
+		AllocationCounters total;
+	};
+	const FrameAllocations& getFrameAllocations();	// Of the last frame
+	size_t getAllocationFailure();				// With STRICT_ALLOCATIONS, the frame that allocated and stopped the game (0 if none)
+
+	// Spawning and despawning
+	//	Changes are queued and applied together at the start of the next update, so a whole batch is merged in one pass
+	Handle spawnObject(float x, float y, float radius, bool isStatic = false);	// The object can be set up through getObject right away
+	int despawnObject(Handle handle);			// Returns 1 if the object existed
+	Object* getObject(Handle handle);			// Returns NULL if the object was despawned
+	int applyForce(Handle handle, const vector& force);	// Pushes the object during the next update only, returns 0 if the object was despawned
+
+	// Spatial queries, answered through the active broadphase plus the static BVH
+	//	Results are appended to found. Any number of threads can query at once, just not while update is running.
+	struct RegionQuery {
+		vector min, max;
+	};
+	void queryRegion(const vector& min, const vector& max, std::vector<Object*>& found);	// Objects whose bounds overlap [min, max]
+	void queryPoint(const vector& point, std::vector<Object*>& found);					// Objects that contain point
+	void queryRadius(const vector& center, float radius, std::vector<Object*>& found);	// Objects that touch the circle
+	void queryNearest(const vector& point, size_t k, std::vector<Object*>& found);		// The k objects with centers closest to point, closest first
+	void queryRegionBatch(const std::vector<RegionQuery>& queries, std::vector<size_t>& offsets, std::vector<Object*>& found);	// Results of queries[i] are found[offsets[i], offsets[i + 1])
+
+	// Ray and segment casts, through the active broadphase plus the static BVH (same threading rules as the queries)
+	int raycast(const Ray& ray, RaycastMode mode, std::vector<RaycastHit>& hits);	// Appends the hits, returns how many were added
+	int segmentCast(const vector& start, const vector& end, RaycastMode mode, std::vector<RaycastHit>& hits, const CollisionFilter& filter = CollisionFilter());
+	void raycastBatch(const std::vector<Ray>& rays, RaycastMode mode, std::vector<size_t>& offsets, std::vector<RaycastHit>& hits);	// Hits of rays[i] are hits[offsets[i], offsets[i + 1])
+
+	// Snapshots (see Snapshot.h)
+	int saveSnapshot(const char* path);			// Writes the whole scene before returning, returns 1 on success
+	int beginSnapshot(const char* path);		// Captures the scene now and writes it out a piece at a time over the next updates
+	int loadSnapshot(const char* path);			// Replaces every object with the ones in the snapshot, returns 0 (and changes nothing) if it can't be read
+
+	// Replays (see Replay.h)
+	//	Replaying in the collision mode that was recorded reproduces the recording bit for bit, which is checked every frame.
+	//	Other modes get the same inputs, but objects that touch several others in a frame can be resolved in a different order.
+	int startRecording(const char* path);		// Saves the scene to path + ".snap" and logs every frame's inputs to path from now on
+	void stopRecording();
+	int loadReplay(const char* path);			// Loads a recording's scene, replayFrame then plays it back
+	int replayFrame();							// Runs the next recorded frame through update, returns 0 once the recording has ended
+	size_t getReplayMismatch();					// First replayed frame whose state differed from the recording (0 if none)
+
+	// Frame capture (see FrameEncoder.h)
+	//	Every interval-th update is copied out at the end of the update and drawn and encoded on a background thread, so it
+	//	works headless and never holds up the simulation. Frames are culled to the camera like render.
+	int startCapture(const char* path, CaptureFormat format, int interval = 1);	// Returns 0 if the output can't be created
+	int stopCapture();							// Writes out the frames still queued, returns 1 if every captured frame was written
+	size_t getDroppedCaptureFrames();			// Frames skipped because the encoder was still busy
+
+	// Contact events (only with CONTACT_EVENTS)
+	const std::vector<ContactEvent>& getContactEvents();	// This frame's events, the transitions come first
+	size_t getContactTransitionCount();						// getContactEvents()[0, count) are begin and end events, the rest are persist events
 	size_t totalFrames;
 	double totalRuntime;						// Stored in seconds
 
@@ -39,16 +160,51 @@ private:
 	Color colliderColor = Color(0,255,0,255);
 	Color collisionColor = Color(255, 0, 0, 255);
 	Color overlapColor = Color(0, 100, 128, 255);
+	Color staticColor = Color(128, 128, 128, 255);
 	SDL_Window* window;
 	int windowHeight;
 	int windowWidth;
 	SDL_Renderer* renderer;
-	std::vector<Object*> objects;
+	std::vector<Object*> objects;				// Only moving objects, static ones live in staticObjects
+	std::vector<Object*> staticObjects;
+
+	// Memory
+	Pool<Object> objectPool;					// Every Object is allocated from this pool, AABBs are part of their object
+	FrameArena frameArena;						// Scratch memory for the current frame, reset at the start of every update
+	Object* createObject(float x, float y, float radius, bool withAABB);
+	void destroyObject(Object* object);			// Frees the object, the caller removes it from objects
+	bool usesAABB();							// Does the collision mode need AABBs on moving objects?
+
+	// Fat AABBs (see FatBox in Object.h), for the broadphases that keep their structure across frames
+	std::vector<std::pair<Object*, FatBox>> dirtyObjects;	// Objects whose fat box was redone this frame, with the box they had before
+	bool usesFatBoxes();						// Sweep and prune and the uniform grid
+	void refreshFatBoxes();						// Redoes the fat box of every moving object that left its own and lists it in dirtyObjects
+	void fattenBox(Object* object, float timestep);	// Makes room for the motion over a few steps this long
+	void resetFatBoxes();						// Empties every fat box and the grid, so everything is fattened again from scratch
+
+	// Storage order (see setStorageReorderInterval)
+	int reorderInterval = 600;
+	int framesSinceReorder = 0;					// Counted from the last reorder, a recording or a loaded snapshot
+	float spreadAfterReorder = -1;				// orderSpread right after the last reorder, negative reorders at the next check
+	size_t storageReorders = 0;
+	std::vector<std::pair<unsigned int, unsigned int>> reorderKeys;	// Morton code and index into objects
+	std::vector<Object*> reordered;
+	std::vector<Handle> reorderHandles;
+	void updateStorageOrder();					// Reorders if it is due
+	void reorderStorage();
+	float orderSpread();						// Mean distance between objects next to each other in objects
+
+	// Queued spawns and despawns
+	std::vector<Object*> pendingSpawns;
+	std::vector<Object*> pendingDespawns;
+	std::vector<std::pair<Handle, vector>> pendingForces;
+	void applySpawnsAndDespawns();
+	void applyForces();
 
 	std::chrono::steady_clock::time_point lastTime;
 	float deltaTime;							// Deltatime is measured in seconds
-	int flags;
-	bool running;
+	std::atomic<int> flags;						// The broadphase bits change with ADAPTIVE_BROADPHASE, other threads read the rest
+	std::atomic<bool> running;
 
 	// Metrics
 	float minFPS, maxFPS;
@@ -56,20 +212,145 @@ private:
 	float fpsTimerInterval = 0.05f;				// How many seconds often to print the FPS
 	size_t countedFrames;						// This could also be called currentFrame
 
-	void DrawCircle(SDL_Renderer* renderer, Object& circle);	// Draws a circle. (circle rasterization)
+	BatchRenderer batchRenderer;				// Everything render draws goes through here
+	TripleBuffer<RenderState> renderStates;		// Frames handed from update to render
+	void publishRenderState();					// Hands the current frame to render
+	void fillRenderState(RenderState& state);	// Copies what drawing needs out of the current frame, culled to the camera
+	void drawRenderState(const RenderState& state);
+	RenderPalette palette();
+
+	// Camera members
+	std::mutex cameraLock;						// The camera is set from the rendering side and read by the simulation
+	Camera camera;
+	struct LodTile {
+		float coverage;							// Screen area of the objects in the tile over the tile's area
+		float aggregated;						// Area of the ones that are drawn as part of the tile
+		unsigned int r, g, b, count;			// Color sums of those
+	};
+	std::vector<Object*> visibleObjects;		// Reused by publishRenderState
+	std::vector<LodTile> lodTiles;
+	std::vector<int> objectTiles;				// Tile of each visible object
+
+	// Capture members
+	FrameEncoder frameEncoder;
+	int captureInterval = 1;
+
+	// Pipelining members
+	std::thread simulationThread;
+	std::atomic<float> simulationRate;
+	void simulate();							// Body of the simulation thread
 	
+	// Collision pipeline (see Pipeline.h)
+	//	Each shipped configuration is compiled on its own, selectPipeline picks the ones for the game's flags up front.
+	typedef void (Game::*CollisionPass)();
+	CollisionPass collisionPasses[2];			// The configuration for sorting along x and along y (the same one without sorting)
+	void selectPipeline();
+	template <class Broadphase, class Narrowphase, bool Recolor>
+	void selectPasses();
+	template <class Broadphase, class Narrowphase, class Response, class Axis>
+	void collide();								// One frame of collision detection and response, moving and static
+	template <class Narrowphase, class Response>
+	void resolve(Object& a, Object& b);			// Tests a candidate pair and makes it bounce if it touches; updates the lastCollisionFrame member in objects
+	template <class Narrowphase, class Response, class Axis>
+	void findPairs(NoBroadphase) {}
+	template <class Narrowphase, class Response, class Axis>
+	void findPairs(BruteForceBroadphase);
+	template <class Narrowphase, class Response, class Axis>
+	void findPairs(SweepAndPruneBroadphase);
+	template <class Narrowphase, class Response, class Axis>
+	void findPairs(VarianceSweepAndPruneBroadphase);
+	template <class Narrowphase, class Response, class Axis>
+	void findPairs(UniformGridBroadphase);
+	template <class Narrowphase, class Response, class Axis>
+	void findPairs(LinearBVHBroadphase);
+	template <class Narrowphase, class Response, class Axis>
+	void findPairs(NeighborListBroadphase);
+
 	// Sweep and prune members
 	static char sortAxis;		// This should only ever be 'x' or 'y'
-	static bool cmpAABBPositions(const Object* a, const Object* b);
-	int AABBOverlap(Object* a, Object* b);	// Returns 1 if overlap, otherwise returns 0; updates the lastOverlapFrame member in objects
+	char sortedAxis = 0;		// The axis objects were sorted along last frame (0 before the first sort)
+	template <class Axis>
+	void sortObjects();			// Sorts objects along Axis, cheaply if they were already sorted along it last frame
+	template <class Narrowphase, class Response, class Axis, bool ChooseAxis>
+	void sweepAndPrune();		// With ChooseAxis, sortAxis becomes the axis objects are most spread out along; updates the lastOverlapFrame member in objects
+	BoxQuantizer worldQuantizer;				// Fitted to the window, objects are kept inside it
+	std::vector<QuantizedBox> sortedBoxes;		// Fat boxes in objects order at the last sort, the sweep reads these instead of the objects
+	struct SweepChunk {							// One thread's share of the sweep
+		std::vector<std::pair<uint32_t, uint32_t>> pairs;	// Candidates as indices into objects, in the order the sweep found them (empty with one thread)
+		float minX, minY, maxX, maxY;			// Bounds of the chunk's AABBs, for variance sweep and prune
+		float maxExtent;						// Widest fat box along the sort axis, while sorting
+	};
+	std::vector<SweepChunk> sweepChunks;
+	StableSortScratch<Object*> sortScratch;		// For the full sort when the insertion sort gives up or the axis changes
+	std::vector<size_t> sweepBounds;			// Chunk c sweeps the objects starting in [sweepBounds[c], sweepBounds[c + 1])
+	std::vector<size_t> sweepWork;				// splitSweep's running total of the estimated candidates
+	template <class Axis>
+	void splitSweep(size_t chunks);				// Fills sweepBounds so every chunk has about as many candidates to look at
+	template <class Axis, bool ChooseAxis, class Found>
+	void sweepRange(SweepChunk& chunk, size_t begin, size_t end, Found found);	// Calls found(i, j) for the candidate pairs of the objects starting in [begin, end), in order
 
 	// Uniform Grid members
 	UniformGrid uniformGrid;
 
+	// Linear BVH members
+	LinearBVH linearBVH;
+	std::vector<std::pair<Object*, Object*>> bvhPairs;	// Reused every frame so the pair list doesn't get reallocated
+
+	// Neighbor list members
+	NeighborList neighborList;					// Invalidated whenever objects are spawned, despawned or loaded
+
+	// Adaptive broadphase members
+	BroadphaseSelector broadphaseSelector;
+	double lastCollisionMs = 0;					// How long the last collision pass took
+	void chooseBroadphase();					// Lets the selector look at the scene and switches if it picked another broadphase
+	void switchBroadphase(int broadphase);		// Changes the broadphase flag and drops the old broadphase's state
+
+	// Allocation accounting members
+	FrameAllocations frameAllocations;
+	AllocationCounters allocationsAtFrameEnd[ALLOCATION_SUBSYSTEMS];	// Counters when the last frame ended
+	AllocationCounters allocationsAtPrint;		// Totals when the framerate was last printed
+	int64_t peakSincePrint = 0;
+	size_t settledFrames = 0;					// Updates since the scene last changed shape
+	size_t allocationFailure = 0;
+	void endFrameAllocations();					// Fills frameAllocations and applies STRICT_ALLOCATIONS
+
+	// Static geometry members
+	StaticBVH staticBVH;						// Built once in the constructor
+	std::vector<Object*> staticFound;			// Reused query results
+	template <class Narrowphase, class Response>
+	void collideWithStatic();					// Tests every moving object against the static geometry
+
+	// Spatial query members
+	//	The broadphase structures are built before objects move each frame, so queries widen their search by how far objects moved
+	size_t broadphaseFrame = 0;					// Frame the broadphase structures were last built in (0 means never)
+	float maxDisplacement = 0;					// Furthest any object moved along one axis in the last updatePositions
+	std::vector<float> sortedMins;				// Sweep and prune: fat box mins along sortedAxis at the last sort, in objects order
+	float maxSortedExtent = 0;					// Widest fat box along sortedAxis at the last sort
+	void gatherCandidates(const vector& min, const vector& max, std::vector<Object*>& candidates);	// Appends a superset of the moving objects overlapping [min, max]
+	void castThroughBroadphase(RaycastCollector& collector);	// Feeds the collector the moving objects near its ray
+
+	// Contact tracking
+	ContactCache contactCache;
+
+	// Snapshot members
+	SnapshotWriter snapshotWriter;				// Holds a captured scene until it has been written out
+	void captureSnapshot();						// Copies the scene into snapshotWriter
+
+	// Replay members
+	ReplayWriter replayWriter;
+	ReplayFrame recordedFrame;					// Inputs of the frame being recorded
+	std::unordered_map<size_t, uint32_t> replayIndices;	// Object id to replay index while recording
+	uint32_t nextReplayIndex = 0;
+	ReplayReader replayReader;
+	ReplayFrame playbackFrame;
+	std::vector<Handle> replayHandles;			// Replay index to object while playing back
+	bool checkReplay = false;					// Are checksums comparable (same collision mode as the recording)?
+	size_t replayedFrames = 0;
+	size_t replayMismatch = 0;
+	uint64_t stateChecksum();					// Hash of every moving object's position and velocity bits
+
 	// Collision Functions
-	int boundingCircleCollision(Object& a, Object& b);	// Returns 1 if collision, 0 if not; updates the lastCollisionFrame member in objects
-	int AABBCollision(Object& a, Object& b);			// Returns 1 if collision, 0 if not; updates the lastCollisionFrame member in objects
 	int isColliding(Object* object);					// Returns 1 if there was a collision this frame;
-	int isOverlapping(Object* object);					// Returns 1 if the object is overlapping with another this frame (only updated for SWEEP_AND_PRUNE_AABB)
+	int isOverlapping(Object* object);					// Returns 1 if the object's AABB (roughly) overlapped another one's this frame (only updated for sweep and prune and the linear BVH)
 };
 
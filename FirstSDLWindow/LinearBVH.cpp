@@ -0,0 +1,362 @@
+#include "LinearBVH.h"
+#include "Parallel.h"
+#include "CollisionFilter.h"
+#include "Morton.h"
+#include <algorithm>
+#include <limits>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static const size_t MIN_CHUNK_SIZE = 1024;	// Below this many items per thread, starting threads costs more than it saves
+
+static int countLeadingZeros(unsigned int value) {	// value must not be 0
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse(&index, value);
+	return 31 - (int)index;
+#else
+	return __builtin_clz(value);
+#endif
+}
+
+int LinearBVH::delta(int i, int j) const {
+	if (j < 0 || j >= (int)sorted.size()) return -1;
+	if (codes[i] != codes[j]) return countLeadingZeros(codes[i] ^ codes[j]);
+	return 32 + countLeadingZeros((unsigned int)i ^ (unsigned int)j);	// Equal codes are told apart by their position
+}
+
+void LinearBVH::build(const std::vector<Object*>& objects) {
+	size_t n = objects.size();
+	sorted.resize(n);
+	if (n == 0) return;
+
+	// Bounds of the AABB centers, so the Morton grid covers the whole scene, and of the AABBs themselves for quantizing them
+	size_t chunks = parallelChunks(n, MIN_CHUNK_SIZE);
+	chunkBounds.resize(chunks * 8);
+	parallelFor(n, MIN_CHUNK_SIZE, [&](size_t begin, size_t end, size_t chunk) {
+		float minX = std::numeric_limits<float>::infinity(), minY = minX;
+		float maxX = -minX, maxY = -minX;
+		float lowX = minX, lowY = minX, highX = maxX, highY = maxX;
+		for (size_t i = begin; i < end; i++) {
+			const AxisAlignedBoundingBox* box = objects[i]->AABB;
+			minX = std::min(minX, box->center->x);
+			minY = std::min(minY, box->center->y);
+			maxX = std::max(maxX, box->center->x);
+			maxY = std::max(maxY, box->center->y);
+			lowX = std::min(lowX, box->center->x - box->radi[0]);
+			lowY = std::min(lowY, box->center->y - box->radi[1]);
+			highX = std::max(highX, box->center->x + box->radi[0]);
+			highY = std::max(highY, box->center->y + box->radi[1]);
+		}
+		float* bounds = &chunkBounds[chunk * 8];
+		bounds[0] = minX;
+		bounds[1] = minY;
+		bounds[2] = maxX;
+		bounds[3] = maxY;
+		bounds[4] = lowX;
+		bounds[5] = lowY;
+		bounds[6] = highX;
+		bounds[7] = highY;
+	});
+	float* bounds = &chunkBounds[0];
+	for (size_t c = 1; c < chunks; c++) {
+		for (int k = 0; k < 8; k++) {
+			bool isMin = (k & 2) == 0;	// Mins and maxes alternate in pairs
+			bounds[k] = isMin ? std::min(bounds[k], chunkBounds[c * 8 + k]) : std::max(bounds[k], chunkBounds[c * 8 + k]);
+		}
+	}
+	float minX = bounds[0], minY = bounds[1], maxX = bounds[2], maxY = bounds[3];
+	float scaleX = (maxX > minX) ? 65535.0f / (maxX - minX) : 0;
+	float scaleY = (maxY > minY) ? 65535.0f / (maxY - minY) : 0;
+	quantizer.fit(bounds[4], bounds[5], bounds[6], bounds[7]);
+
+	// Morton codes
+	codes.resize(n);
+	order.resize(n);
+	parallelFor(n, MIN_CHUNK_SIZE, [&](size_t begin, size_t end, size_t) {
+		for (size_t i = begin; i < end; i++) {
+			const vector* center = objects[i]->AABB->center;
+			unsigned int x = (unsigned int)((center->x - minX) * scaleX);
+			unsigned int y = (unsigned int)((center->y - minY) * scaleY);
+			codes[i] = mortonCode(x, y);
+			order[i] = (unsigned int)i;
+		}
+	});
+	radixSort();
+
+	// Leaves
+	nodes.resize(2 * n - 1);
+	parents.resize(2 * n - 1);
+	parents[0] = -1;	// The root (or the single leaf when n == 1)
+	if (visitsCapacity < n) {
+		visits.reset(new std::atomic<int>[n]);
+		visitsCapacity = n;
+	}
+	parallelFor(n, MIN_CHUNK_SIZE, [&](size_t begin, size_t end, size_t) {
+		for (size_t i = begin; i < end; i++) {
+			Object* object = objects[order[i]];
+			sorted[i] = object;
+			Node& leaf = nodes[leafIndex((int)i)];
+			vector min = object->AABB->min();
+			vector max = object->AABB->max();
+			leaf.box = quantizer.quantize(min.x, min.y, max.x, max.y);
+			leaf.left = -1;
+			leaf.right = -1;
+			leaf.first = (int)i;
+			leaf.last = (int)i;
+		}
+	});
+	if (n == 1) {
+		nodes[0].skip = -1;
+		return;
+	}
+
+	// Internal nodes, each one is built independently of the others
+	parallelFor(n - 1, MIN_CHUNK_SIZE, [&](size_t begin, size_t end, size_t) {
+		for (size_t i = begin; i < end; i++) {
+			buildInternalNode((int)i);
+			visits[i].store(0, std::memory_order_relaxed);
+		}
+	});
+
+	// Skip links for the stackless traversal
+	//	The subtree after [first, last] is the right child of the ancestor that splits at last.
+	//	That child is internal node last + 1 if it starts at last + 1, otherwise it is leaf last + 1.
+	int last = (int)n - 1;
+	parallelFor(2 * n - 1, MIN_CHUNK_SIZE, [&](size_t begin, size_t end, size_t) {
+		for (size_t i = begin; i < end; i++) {
+			int next = nodes[i].last + 1;
+			if (nodes[i].last == last) nodes[i].skip = -1;
+			else if (next < last && nodes[next].first == next) nodes[i].skip = next;
+			else nodes[i].skip = leafIndex(next);
+		}
+	});
+
+	// Bounds, from the leaves up. The second child to arrive at a node computes its bounds.
+	parallelFor(n, MIN_CHUNK_SIZE, [&](size_t begin, size_t end, size_t) {
+		for (size_t i = begin; i < end; i++) {
+			computeBounds(leafIndex((int)i));
+		}
+	});
+}
+
+void LinearBVH::radixSort() {	// Stable LSD radix sort of codes (and order along with them), 8 bits per pass
+	size_t n = codes.size();
+	codesScratch.resize(n);
+	orderScratch.resize(n);
+	size_t chunks = parallelChunks(n, MIN_CHUNK_SIZE);
+	histograms.resize(chunks * 256);
+	for (int shift = 0; shift < 32; shift += 8) {
+		std::fill(histograms.begin(), histograms.end(), 0);
+		parallelFor(n, MIN_CHUNK_SIZE, [&](size_t begin, size_t end, size_t chunk) {
+			size_t* histogram = &histograms[chunk * 256];
+			for (size_t i = begin; i < end; i++) {
+				histogram[(codes[i] >> shift) & 0xff]++;
+			}
+		});
+
+		// Turning the counts into scatter offsets: by digit first, then by chunk so the sort stays stable
+		size_t offset = 0;
+		bool singleDigit = false;
+		for (size_t digit = 0; digit < 256; digit++) {
+			size_t digitCount = 0;
+			for (size_t chunk = 0; chunk < chunks; chunk++) {
+				size_t count = histograms[chunk * 256 + digit];
+				histograms[chunk * 256 + digit] = offset;
+				offset += count;
+				digitCount += count;
+			}
+			if (digitCount == n) singleDigit = true;
+		}
+		if (singleDigit) continue;	// Every code has the same digit here, so this pass would not move anything
+
+		parallelFor(n, MIN_CHUNK_SIZE, [&](size_t begin, size_t end, size_t chunk) {
+			size_t* offsets = &histograms[chunk * 256];
+			for (size_t i = begin; i < end; i++) {
+				size_t destination = offsets[(codes[i] >> shift) & 0xff]++;
+				codesScratch[destination] = codes[i];
+				orderScratch[destination] = order[i];
+			}
+		});
+		codes.swap(codesScratch);
+		order.swap(orderScratch);
+	}
+}
+
+void LinearBVH::buildInternalNode(int i) {
+	// Direction of the range covered by this node
+	int d = (delta(i, i + 1) - delta(i, i - 1)) >= 0 ? 1 : -1;
+
+	// Upper bound for the length of the range, then the exact other end through binary search
+	int deltaMin = delta(i, i - d);
+	int lengthMax = 2;
+	while (delta(i, i + lengthMax * d) > deltaMin) lengthMax *= 2;
+	int length = 0;
+	for (int t = lengthMax / 2; t >= 1; t /= 2) {
+		if (delta(i, i + (length + t) * d) > deltaMin) length += t;
+	}
+	int j = i + length * d;
+
+	// Finding where the range splits
+	int deltaNode = delta(i, j);
+	int split = 0;
+	int t = length;
+	do {
+		t = (t + 1) / 2;
+		if (delta(i, i + (split + t) * d) > deltaNode) split += t;
+	} while (t > 1);
+	int gamma = i + split * d + std::min(d, 0);
+
+	Node& node = nodes[i];
+	node.first = std::min(i, j);
+	node.last = std::max(i, j);
+	node.left = (node.first == gamma) ? leafIndex(gamma) : gamma;
+	node.right = (node.last == gamma + 1) ? leafIndex(gamma + 1) : gamma + 1;
+	parents[node.left] = i;
+	parents[node.right] = i;
+}
+
+void LinearBVH::computeBounds(int leaf) {
+	int current = parents[leaf];
+	while (current != -1) {
+		if (visits[current].fetch_add(1, std::memory_order_acq_rel) == 0) return;	// The other child is not done yet, it will continue from here
+		Node& node = nodes[current];
+		node.box = boxUnion(nodes[node.left].box, nodes[node.right].box);
+		current = parents[current];
+	}
+}
+
+void LinearBVH::findPairs(std::vector<std::pair<Object*, Object*>>& pairs) {
+	pairs.clear();
+	int n = (int)sorted.size();
+	if (n < 2) return;
+
+	size_t chunks = parallelChunks(n, MIN_CHUNK_SIZE);
+	if (chunkPairs.size() < chunks) chunkPairs.resize(chunks);
+	parallelFor(n, MIN_CHUNK_SIZE, [&](size_t begin, size_t end, size_t chunk) {
+		std::vector<std::pair<Object*, Object*>>& found = chunkPairs[chunk];
+		found.clear();
+		for (int i = (int)begin; i < (int)end; i++) {
+			QuantizedBox query = queryBox(nodes[leafIndex(i)].box);
+			int current = 0;
+			while (current != -1) {	// Stackless traversal, each pair is only reported by its lower leaf
+				const Node& node = nodes[current];
+				if (node.last > i && boxesOverlap(node.box, query)) {
+					if (node.left == -1) {
+						found.emplace_back(sorted[i], sorted[node.first]);
+						current = node.skip;
+					}
+					else {
+						current = node.left;
+					}
+				}
+				else {
+					current = node.skip;
+				}
+			}
+		}
+		found.resize(filterPairs(found.data(), found.size()));	// Dropping pairs whose collision layers don't interact
+	});
+	for (size_t chunk = 0; chunk < chunks; chunk++) {
+		pairs.insert(pairs.end(), chunkPairs[chunk].begin(), chunkPairs[chunk].end());
+	}
+}
+
+void LinearBVH::queryRegion(const vector& min, const vector& max, std::vector<Object*>& found) const {
+	if (sorted.empty()) return;
+	QuantizedBox query = queryBox(quantizer.quantize(min.x, min.y, max.x, max.y));
+	int current = 0;
+	while (current != -1) {
+		const Node& node = nodes[current];
+		if (boxesOverlap(node.box, query)) {
+			if (node.left == -1) {
+				found.push_back(sorted[node.first]);
+				current = node.skip;
+			}
+			else {
+				current = node.left;
+			}
+		}
+		else {
+			current = node.skip;
+		}
+	}
+}
+
+void LinearBVH::raycast(RaycastCollector& collector, float slack) const {
+	if (sorted.empty()) return;
+	const Ray& ray = collector.ray;
+	float inverseX = safeInverse(ray.direction.x);
+	float inverseY = safeInverse(ray.direction.y);
+	auto hits = [&](const Node& node, float& entry) {
+		return rayHitsBox(ray, inverseX, inverseY, collector.maxT(), quantizer.minX(node.box) - slack, quantizer.minY(node.box) - slack,
+			quantizer.maxX(node.box) + slack, quantizer.maxY(node.box) + slack, entry);
+	};
+
+	// Keys (Morton code, then index) share a longer prefix every level down, so the tree is at most 65 levels deep and the
+	// stack, which grows by one entry per level at most, can't overflow
+	int stack[128];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0 && !collector.done()) {
+		const Node& node = nodes[stack[--top]];
+		float entry;
+		if (!hits(node, entry)) continue;
+		if (node.left == -1) {
+			collector.test(sorted[node.first]);
+			continue;
+		}
+
+		// Visiting the nearer child first, so closest hit searches can cut the farther one off
+		float leftEntry, rightEntry;
+		int hitsLeft = hits(nodes[node.left], leftEntry);
+		int hitsRight = hits(nodes[node.right], rightEntry);
+		if (hitsLeft && hitsRight) {
+			if (leftEntry <= rightEntry) {
+				stack[top++] = node.right;
+				stack[top++] = node.left;
+			}
+			else {
+				stack[top++] = node.left;
+				stack[top++] = node.right;
+			}
+		}
+		else if (hitsLeft) {
+			stack[top++] = node.left;
+		}
+		else if (hitsRight) {
+			stack[top++] = node.right;
+		}
+	}
+}
+
+void LinearBVH::raycastPacket(const Ray* rays, RaycastCollector* const* collectors, int count, float slack) const {
+	if (sorted.empty()) return;
+	RayPacket packet;
+	for (int lane = 0; lane < 4; lane++) {
+		if (lane < count) packet.set(lane, rays[lane], collectors[lane]->maxT());
+		else packet.set(lane, rays[0], -1);	// Unused lanes never hit
+	}
+
+	int current = 0;
+	while (current != -1) {
+		const Node& node = nodes[current];
+		int mask = packet.slabTest(quantizer.minX(node.box) - slack, quantizer.minY(node.box) - slack,
+			quantizer.maxX(node.box) + slack, quantizer.maxY(node.box) + slack);
+		if (mask == 0) {	// No ray in the packet reaches this subtree
+			current = node.skip;
+			continue;
+		}
+		if (node.left != -1) {
+			current = node.left;
+			continue;
+		}
+		for (int lane = 0; lane < count; lane++) {
+			if (!(mask & (1 << lane))) continue;
+			collectors[lane]->test(sorted[node.first]);
+			packet.maxT[lane] = collectors[lane]->done() ? -1 : collectors[lane]->maxT();	// Closer hits shrink the ray
+		}
+		current = node.skip;
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include "Object.h"
+#include "Raycast.h"
+#include "QuantizedBox.h"
+#include <vector>
+#include <utility>
+#include <memory>
+#include <atomic>
+
+// Linear bounding volume hierarchy (Karras 2012)
+//	Objects are sorted along a 2D Morton curve by their AABB centers and the whole tree is rebuilt every frame.
+//	Every step (codes, radix sort, hierarchy, bounds, pair search) runs in parallel and is O(n),
+//	so this does not care how much the objects moved since the last frame.
+//	Node bounds are quantized over the scene's bounds at each build (see QuantizedBox.h), which keeps a node at 28 bytes and
+//	makes every overlap test of the pair search one integer compare. Queries can get a few extra near misses back from that.
+class LinearBVH {
+public:
+	struct Node {
+		QuantizedBox box;
+		int left, right;	// Children of internal nodes (-1 for leaves)
+		int skip;			// Node to continue with once this subtree has been handled (-1 ends the traversal)
+		int first, last;	// Range of sorted leaves covered by this subtree
+	};
+
+	void build(const std::vector<Object*>& objects);						// Rebuilds the hierarchy from the objects' AABBs
+	void findPairs(std::vector<std::pair<Object*, Object*>>& pairs);		// Fills pairs with every overlapping pair of AABBs whose filters collide, each pair once
+	void queryRegion(const vector& min, const vector& max, std::vector<Object*>& found) const;	// Appends every object whose quantized AABB overlapped [min, max] at the last build
+	void raycast(RaycastCollector& collector, float slack) const;	// Feeds the collector every object whose AABB (grown by slack) its ray passes through
+	void raycastPacket(const Ray* rays, RaycastCollector* const* collectors, int count, float slack) const;	// The same for up to 4 rays at once, sharing one traversal
+
+private:
+	std::vector<Object*> sorted;			// Objects in Morton order, leaf i holds sorted[i]
+	std::vector<unsigned int> codes, codesScratch;
+	std::vector<unsigned int> order, orderScratch;
+	std::vector<Node> nodes;				// Internal nodes [0, n - 1), followed by the n leaves
+	BoxQuantizer quantizer;					// Fitted to the AABBs at the last build
+	std::vector<int> parents;
+	std::unique_ptr<std::atomic<int>[]> visits;	// Per internal node arrival counters for the bottom-up bounds pass
+	size_t visitsCapacity = 0;
+	std::vector<std::vector<std::pair<Object*, Object*>>> chunkPairs;	// Thread local pair buffers, merged in chunk order
+	std::vector<float> chunkBounds;			// Per chunk bounds while building
+	std::vector<size_t> histograms;			// Per chunk digit counts while sorting
+
+	int leafIndex(int i) const { return (int)sorted.size() - 1 + i; }
+	int delta(int i, int j) const;			// Length of the common prefix of the keys of leaves i and j (-1 if j is out of range)
+	void radixSort();
+	void buildInternalNode(int i);
+	void computeBounds(int leaf);
+};
@@ -0,0 +1,16 @@
+#pragma once
+
+// Morton (Z-order) codes: interleaving the bits of x and y so that points close in 2D are usually close in the code
+
+inline unsigned int spreadBits(unsigned int v) {	// Inserts a 0 bit in front of each of the lower 16 bits
+	v &= 0x0000ffff;
+	v = (v | (v << 8)) & 0x00ff00ff;
+	v = (v | (v << 4)) & 0x0f0f0f0f;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+inline unsigned int mortonCode(unsigned int x, unsigned int y) {	// x and y are 16 bit grid coordinates
+	return (spreadBits(y) << 1) | spreadBits(x);
+}
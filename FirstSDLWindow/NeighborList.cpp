@@ -0,0 +1,82 @@
+#include "NeighborList.h"
+#include "CollisionFilter.h"
+#include <algorithm>
+#include <cmath>
+
+NeighborList::NeighborList(float skin) {
+	this->skin = skin;
+}
+
+void NeighborList::setSkin(float skin) {
+	this->skin = std::max(skin, 0.0f);
+}
+
+float NeighborList::getSkin() const {
+	return skin;
+}
+
+bool NeighborList::isStale(const std::vector<Object*>& objects) const {
+	if (!valid || objects.size() != tracked.size()) return true;
+	float limit = builtSkin / 2;
+	for (size_t i = 0; i < tracked.size(); i++) {
+		const vector& pos = tracked[i]->pos;
+		if (std::abs(pos.x - anchors[i].x) > limit || std::abs(pos.y - anchors[i].y) > limit) return true;
+	}
+	return false;
+}
+
+void NeighborList::build(const std::vector<Object*>& objects, const StaticBVH& staticBVH) {
+	rebuilds++;
+	valid = true;
+	builtSkin = skin;
+	tracked = objects;
+	anchors.resize(objects.size());
+	for (size_t i = 0; i < objects.size(); i++) {
+		anchors[i] = objects[i]->pos;
+	}
+
+	// Moving pairs, by sweeping along x with every box grown by half the skin
+	pairs.clear();
+	sorted = objects;
+	std::sort(sorted.begin(), sorted.end(), [](const Object* a, const Object* b) { return a->AABB->min().x < b->AABB->min().x; });
+	for (size_t i = 0; i < sorted.size(); i++) {
+		const AxisAlignedBoundingBox* box = sorted[i]->AABB;
+		float end = box->center->x + box->radi[0] + skin;
+		for (size_t j = i + 1; j < sorted.size(); j++) {
+			const AxisAlignedBoundingBox* other = sorted[j]->AABB;
+			if (other->center->x - other->radi[0] > end) break;
+			if (std::abs(box->center->y - other->center->y) > box->radi[1] + other->radi[1] + skin) continue;
+			if (!shouldCollide(sorted[i]->filter, sorted[j]->filter)) continue;
+			pairs.emplace_back(sorted[i], sorted[j]);
+		}
+	}
+
+	// Walls don't move, so half the skin is enough for them
+	wallPairs.clear();
+	found.reserve(staticBVH.size());
+	vector reach(skin / 2, skin / 2);
+	for (auto object : objects) {
+		found.clear();
+		staticBVH.query(object->AABB->min() - reach, object->AABB->max() + reach, found);
+		for (auto wall : found) {
+			if (shouldCollide(object->filter, wall->filter)) wallPairs.emplace_back(object, wall);
+		}
+	}
+}
+
+void NeighborList::invalidate() {
+	valid = false;
+	tracked.clear();	// The objects may not exist anymore
+}
+
+const std::vector<std::pair<Object*, Object*>>& NeighborList::movingPairs() const {
+	return pairs;
+}
+
+const std::vector<std::pair<Object*, Object*>>& NeighborList::staticPairs() const {
+	return wallPairs;
+}
+
+size_t NeighborList::getRebuilds() const {
+	return rebuilds;
+}
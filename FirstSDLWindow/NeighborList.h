@@ -0,0 +1,36 @@
+#pragma once
+#include "Object.h"
+#include "StaticBVH.h"
+#include <vector>
+#include <utility>
+
+// Verlet neighbor list (as in molecular dynamics)
+//	Every pair whose AABBs come within skin of each other is listed once, and the list is reused until some object has moved
+//	more than half the skin along an axis since then. Two objects that close in on each other cover at most skin together
+//	in that time, so every pair that touches is still in the list. Frames in between only run the narrowphase over it.
+class NeighborList {
+public:
+	NeighborList(float skin = 8.0f);
+	void setSkin(float skin);						// Takes effect at the next rebuild
+	float getSkin() const;
+
+	bool isStale(const std::vector<Object*>& objects) const;	// Does the list need to be rebuilt before it can be used?
+	void build(const std::vector<Object*>& objects, const StaticBVH& staticBVH);	// Objects must have their AABBs
+	void invalidate();								// Objects were spawned, despawned or replaced, the next isStale says so
+
+	const std::vector<std::pair<Object*, Object*>>& movingPairs() const;	// Both moving, in a fixed order until the next rebuild
+	const std::vector<std::pair<Object*, Object*>>& staticPairs() const;	// Moving object first, then the static one
+	size_t getRebuilds() const;						// How often build has run
+
+private:
+	float skin;
+	float builtSkin = 0;							// Skin the current list was built with
+	bool valid = false;
+	std::vector<Object*> tracked;					// Objects at the last build and where they were
+	std::vector<vector> anchors;
+	std::vector<Object*> sorted;					// Scratch for the build's sweep
+	std::vector<Object*> found;
+	std::vector<std::pair<Object*, Object*>> pairs;
+	std::vector<std::pair<Object*, Object*>> wallPairs;
+	size_t rebuilds = 0;
+};
@@ -1,9 +1,10 @@
 #include "Object.h"
 #include <cstdlib>
+#include <algorithm>
 
-int Object::createAABB() {	
-	AABB = new AxisAlignedBoundingBox;
+int Object::createAABB() {
 	if (isCircle) {
+		AABB = &collider;
 		AABB->center = &pos;
 		AABB->radi[0] = radius;
 		AABB->radi[1] = radius;
@@ -15,12 +16,12 @@ int Object::createAABB() {
 }
 
 int Object::destroyAABB() {
-	delete AABB;
+	if (AABB == NULL) return 0;
 	AABB = NULL;
-	return 0;
+	return 1;
 }
 
-Object::Object(float x, float y, size_t ident) {
+Object::Object(float x, float y, uint32_t ident) {
 	pos.x = x;
 	pos.y = y;
 	isVisible = true;
@@ -34,7 +35,7 @@ Object::Object(float x, float y, size_t ident) {
 	AABB = NULL;
 }
 
-Object::Object(float x, float y, float radius, size_t ident) {
+Object::Object(float x, float y, float radius, uint32_t ident) {
 	pos.x = x;
 	pos.y = y;
 	color = Color(255, 255, 255, 255);
@@ -49,6 +50,27 @@ Object::Object(float x, float y, float radius, size_t ident) {
 	AABB = NULL;
 }
 
+Object::Object(Object&& in) {
+	pos = in.pos;
+	collider = in.collider;
+	collider.center = &pos;
+	AABB = (in.AABB != NULL) ? &collider : NULL;
+	filter = in.filter;
+	lastCollisionFrame = in.lastCollisionFrame;
+	lastOverlapFrame = in.lastOverlapFrame;
+	id = in.id;
+	radius = in.radius;
+	isStatic = in.isStatic;
+	isCircle = in.isCircle;
+	isVisible = in.isVisible;
+	vel = in.vel;
+	acc = in.acc;
+	mass = in.mass;
+	fatBox = in.fatBox;
+	color = in.color;
+	handle = in.handle;
+}
+
 SDL_Rect AxisAlignedBoundingBox::toSDLRect()
 {
 	SDL_Rect ret;
@@ -69,6 +91,18 @@ vector AxisAlignedBoundingBox::max()
 	return vector(center->x + radi[0], center->y + radi[1]);
 }
 
+bool FatBox::contains(const AxisAlignedBoundingBox& box) const {
+	return box.center->x - box.radi[0] >= minX && box.center->x + box.radi[0] <= maxX &&
+		box.center->y - box.radi[1] >= minY && box.center->y + box.radi[1] <= maxY;
+}
+
+void FatBox::fatten(const AxisAlignedBoundingBox& box, const vector& displacement, float margin) {
+	minX = box.center->x - box.radi[0] - margin + std::min(displacement.x, 0.0f);
+	minY = box.center->y - box.radi[1] - margin + std::min(displacement.y, 0.0f);
+	maxX = box.center->x + box.radi[0] + margin + std::max(displacement.x, 0.0f);
+	maxY = box.center->y + box.radi[1] + margin + std::max(displacement.y, 0.0f);
+}
+
 Color::Color(unsigned char r, unsigned char g, unsigned char b, unsigned char a)
 {
 	this->r = r;
@@ -1,5 +1,8 @@
 #pragma once
 #include <SDL_rect.h>
+#include "Pool.h"
+#include "CollisionFilter.h"
+#include <cstdint>
 
 struct Color {
 	unsigned char r, g, b, a;	// RGB and alpha for opacity
@@ -41,30 +44,54 @@ struct AxisAlignedBoundingBox {
 	vector max();	// Returns the bottom-right point
 };
 
+struct FatBox {	// Bounds padded past an AABB, so broadphase structures only have to change once the AABB leaves them
+	float minX = 0, minY = 0;
+	float maxX = -1, maxY = -1;	// Empty (containing nothing) until a broadphase first fattens it
+	bool isEmpty() const { return minX > maxX; }
+	bool contains(const AxisAlignedBoundingBox& box) const;
+	bool overlaps(const FatBox& other) const { return minX <= other.maxX && other.minX <= maxX && minY <= other.maxY && other.minY <= maxY; }
+	void fatten(const AxisAlignedBoundingBox& box, const vector& displacement, float margin);	// Covers box, box moved by displacement and margin around both
+};
+
 
-class Object {	// I'm making all of this public for ease
+// Fields are grouped by what reads them and the object starts on a cache line, so a pass only pulls in its own group
+//	First line, collision detection: position, collider, filter, frame stamps, id and the packed flags
+//	Second line, integration and collision response: velocity, acceleration and mass, and the fat box lazy broadphases keep
+//	After that, cold data only rendering and bookkeeping read
+class alignas(64) Object {	// I'm making all of this public for ease
 public:
 	vector pos;
-	vector vel;
-	vector acc;
-	bool isVisible;
-	bool isStatic;
-	Color color = Color(255, 255, 255, 255);	// Automatically set to white
-	size_t id;
-	int mass;		// This is probably always going to be 1, but we can change this for fun
 
-	bool isCircle;
+	// Colliders
+	AxisAlignedBoundingBox* AABB;	// Points at collider while the object has an AABB, NULL otherwise
+	AxisAlignedBoundingBox collider;
+
+	// Which objects this one collides with (see CollisionFilter.h)
+	CollisionFilter filter;
+
+	// Tracking when we previously collided (frame numbers, wrapping after 2^32 frames)
+	uint32_t lastCollisionFrame = 0;
+	uint32_t lastOverlapFrame = 0;
+
+	uint32_t id;
 	float radius;
+	bool isStatic : 1;
+	bool isCircle : 1;
+	bool isVisible : 1;
 
-	// Tracking when we previously collided
-	size_t lastCollisionFrame = 0;
-	size_t lastOverlapFrame = 0;
+	vector vel;
+	vector acc;
+	int mass;		// This is probably always going to be 1, but we can change this for fun
+	FatBox fatBox;	// Only kept up to date by the broadphases that use it (see Game::refreshFatBoxes)
 
-	// Colliders
-	AxisAlignedBoundingBox* AABB;
+	Color color = Color(255, 255, 255, 255);	// Automatically set to white
+	Handle handle;	// Pool handle (set by whoever allocated the object)
 
-	int createAABB();	// Returns 1 on a successful creation, 0 on failure
+	int createAABB();	// Points AABB at collider. Returns 1 on a successful creation, 0 on failure
 	int destroyAABB();	// Returns 1 on a successful deletion
-	Object(float x, float y, size_t ident);
-	Object(float x, float y, float radius, size_t ident);
+	Object(float x, float y, uint32_t ident);
+	Object(float x, float y, float radius, uint32_t ident);
+	Object(Object&& in);			// For the pool reordering its storage, points AABB and collider.center at the new object
+	Object(const Object&) = delete;	// AABB and collider.center point into the object itself
+	Object& operator= (const Object&) = delete;
 };
@@ -0,0 +1,103 @@
+#include "OffscreenRenderer.h"
+#include <algorithm>
+
+void OffscreenRenderer::resize(int width, int height) {
+	columns = std::max(width, 0);
+	rows = std::max(height, 0);
+	framebuffer.resize((size_t)columns * rows * 3);
+}
+
+void OffscreenRenderer::clear(const Color& color) {
+	for (size_t i = 0; i < framebuffer.size(); i += 3) {
+		framebuffer[i] = color.r;
+		framebuffer[i + 1] = color.g;
+		framebuffer[i + 2] = color.b;
+	}
+}
+
+void OffscreenRenderer::point(int x, int y, const Color& color) {	// Drawn opaque, like SDL's default blend mode
+	blend(x, y, color, 256);
+}
+
+void OffscreenRenderer::rect(const SDL_Rect& rect, const Color& color) {
+	if (rect.w <= 0 || rect.h <= 0) return;
+	int right = rect.x + rect.w - 1;
+	int bottom = rect.y + rect.h - 1;
+	for (int x = rect.x; x <= right; x++) {
+		point(x, rect.y, color);
+		point(x, bottom, color);
+	}
+	for (int y = rect.y + 1; y < bottom; y++) {
+		point(rect.x, y, color);
+		point(right, y, color);
+	}
+}
+
+void OffscreenRenderer::circle(float x, float y, float radius, const Color& color) {	// The midpoint algorithm from SpriteCache::rasterize
+	int centreX = (int)x;
+	int centreY = (int)y;
+	const float diameter = (radius * 2);
+
+	float dx = (radius - 1);
+	float dy = 0;
+	float tx = 1;
+	float ty = 1;
+	float error = (tx - diameter);
+
+	while (dx >= dy)
+	{
+		//  Each of the following is a point in one octant of the circle
+		int offsets[8][2] = { { (int)dx, -(int)dy }, { (int)dx, (int)dy }, { -(int)dx, -(int)dy }, { -(int)dx, (int)dy },
+			{ (int)dy, -(int)dx }, { (int)dy, (int)dx }, { -(int)dy, -(int)dx }, { -(int)dy, (int)dx } };
+		for (auto& offset : offsets) {
+			point(centreX + offset[0], centreY + offset[1], color);
+		}
+
+		if (error <= 0)
+		{
+			++dy;
+			error += ty;
+			ty += 2;
+		}
+
+		if (error > 0)
+		{
+			--dx;
+			tx += 2;
+			error += (tx - diameter);
+		}
+	}
+}
+
+void OffscreenRenderer::fill(const SDL_Rect& rect, const Color& color) {
+	int left = std::max(rect.x, 0);
+	int top = std::max(rect.y, 0);
+	int right = std::min(rect.x + rect.w, columns);
+	int bottom = std::min(rect.y + rect.h, rows);
+	unsigned int alpha = color.a + (color.a >> 7);	// 0-255 onto 0-256, so opaque really is opaque
+	for (int y = top; y < bottom; y++) {
+		for (int x = left; x < right; x++) {
+			blend(x, y, color, alpha);
+		}
+	}
+}
+
+const unsigned char* OffscreenRenderer::pixels() const {
+	return framebuffer.data();
+}
+
+int OffscreenRenderer::width() const {
+	return columns;
+}
+
+int OffscreenRenderer::height() const {
+	return rows;
+}
+
+void OffscreenRenderer::blend(int x, int y, const Color& color, unsigned int alpha) {
+	if (x < 0 || y < 0 || x >= columns || y >= rows) return;
+	unsigned char* pixel = &framebuffer[((size_t)y * columns + x) * 3];
+	pixel[0] = (unsigned char)((color.r * alpha + pixel[0] * (256 - alpha)) >> 8);
+	pixel[1] = (unsigned char)((color.g * alpha + pixel[1] * (256 - alpha)) >> 8);
+	pixel[2] = (unsigned char)((color.b * alpha + pixel[2] * (256 - alpha)) >> 8);
+}
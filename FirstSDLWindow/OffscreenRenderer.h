@@ -0,0 +1,25 @@
+#pragma once
+#include "Object.h"
+#include <cstdint>
+#include <vector>
+
+// Software rasterizer with the same drawing calls as BatchRenderer, for capturing frames without a display or GPU
+//	Pixels are RGB, three bytes each, rows top to bottom. Everything is clipped to the framebuffer.
+class OffscreenRenderer {
+public:
+	void resize(int width, int height);
+	void clear(const Color& color);
+	void point(int x, int y, const Color& color);
+	void rect(const SDL_Rect& rect, const Color& color);				// One pixel wide outline
+	void circle(float x, float y, float radius, const Color& color);	// One pixel wide outline, the same pixels SpriteCache draws
+	void fill(const SDL_Rect& rect, const Color& color);				// Alpha blended
+	const unsigned char* pixels() const;
+	int width() const;
+	int height() const;
+
+private:
+	std::vector<unsigned char> framebuffer;
+	int columns = 0, rows = 0;
+
+	void blend(int x, int y, const Color& color, unsigned int alpha);	// alpha from 0 to 256
+};
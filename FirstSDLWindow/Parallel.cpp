@@ -0,0 +1,116 @@
+#include "Parallel.h"
+#include "Allocations.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <algorithm>
+
+static thread_local bool insideParallelFor = false;	// Set while running a chunk, a parallelFor from inside one runs serially
+
+// Threads parallelFor hands chunks 1 and up to, started on first use and kept until the program exits, so a parallelFor
+// doesn't have to start threads (and allocate for them) every time
+class WorkerPool {
+public:
+	explicit WorkerPool(size_t workers) {
+		for (size_t w = 1; w <= workers; w++) {
+			threads.emplace_back(&WorkerPool::work, this, w);
+		}
+	}
+
+	~WorkerPool() {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto& thread : threads) {
+			thread.join();
+		}
+	}
+
+	bool run(size_t count, size_t chunks, const ChunkBody& body) {	// Returns false without running anything if another thread is using the pool
+		std::unique_lock<std::mutex> owner(user, std::try_to_lock);
+		if (!owner.owns_lock()) return false;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			this->body = &body;
+			this->count = count;
+			this->chunks = chunks;
+			subsystem = currentAllocationSubsystem();	// Workers count their allocations against what the caller is doing
+			remaining = chunks - 1;
+			job++;
+		}
+		wake.notify_all();
+		runChunk(body, count, chunks, 0);
+		std::unique_lock<std::mutex> guard(lock);
+		done.wait(guard, [this] { return remaining == 0; });
+		return true;
+	}
+
+	static void runChunk(const ChunkBody& body, size_t count, size_t chunks, size_t chunk) {
+		insideParallelFor = true;
+		body(count * chunk / chunks, count * (chunk + 1) / chunks, chunk);
+		insideParallelFor = false;
+	}
+
+private:
+	std::vector<std::thread> threads;
+	std::mutex user;				// Held by the thread whose parallelFor is running on the pool
+	std::mutex lock;				// Guards everything below
+	std::condition_variable wake, done;
+	const ChunkBody* body = NULL;
+	size_t count = 0, chunks = 0;
+	AllocationSubsystem subsystem = ALLOCATION_OTHER;
+	size_t remaining = 0;			// Chunks of the current job still running on workers
+	size_t job = 0;					// Counts up with every parallelFor, workers wait for it to change
+	bool stopping = false;
+
+	void work(size_t worker) {
+		size_t seenJob = 0;
+		std::unique_lock<std::mutex> guard(lock);
+		while (true) {
+			wake.wait(guard, [&] { return stopping || job != seenJob; });
+			if (stopping) return;
+			seenJob = job;
+			if (worker >= chunks) continue;	// Not needed this time
+			const ChunkBody& body = *this->body;
+			size_t count = this->count, chunks = this->chunks;
+			AllocationSubsystem subsystem = this->subsystem;
+			guard.unlock();
+			{
+				AllocationScope scope(subsystem);
+				runChunk(body, count, chunks, worker);
+			}
+			guard.lock();
+			if (--remaining == 0) done.notify_one();
+		}
+	}
+};
+
+size_t workerCount() {
+	static const size_t count = std::max(1u, std::thread::hardware_concurrency());
+	return count;
+}
+
+size_t parallelChunks(size_t count, size_t minChunkSize) {
+	if (count == 0) return 0;
+	if (minChunkSize == 0) minChunkSize = 1;
+	size_t chunks = (count + minChunkSize - 1) / minChunkSize;	// Never make chunks smaller than minChunkSize
+	return std::min(chunks, workerCount());
+}
+
+void parallelFor(size_t count, size_t minChunkSize, const ChunkBody& body) {
+	size_t chunks = parallelChunks(count, minChunkSize);
+	if (chunks == 0) return;
+	if (chunks > 1 && !insideParallelFor) {
+		static WorkerPool pool(workerCount() - 1);
+		if (pool.run(count, chunks, body)) return;
+	}
+
+	// One chunk isn't worth the handoff, and with the pool busy (or from inside a chunk) the caller runs every chunk itself,
+	// which gives the same chunks in the same order
+	for (size_t c = 0; c < chunks; c++) {
+		body(count * c / chunks, count * (c + 1) / chunks, c);
+	}
+}
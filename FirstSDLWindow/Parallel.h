@@ -0,0 +1,99 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+
+// Small helpers for splitting per-object work across threads.
+// Work is always split into contiguous chunks in ascending order, so chunk i covers indices before chunk i + 1.
+// That lets callers merge per-chunk results in chunk order and stay deterministic.
+// The threads are started by the first parallelFor that needs them and then kept, later ones only hand them their chunks.
+
+// What parallelFor runs on every chunk. Unlike a std::function it only refers to the callable, so handing over a lambda
+// never allocates, and the callable has to outlive the call like any argument
+class ChunkBody {
+public:
+	template <typename Body>
+	ChunkBody(const Body& body) : context(&body), call(&invoke<Body>) {}
+	void operator()(size_t begin, size_t end, size_t chunk) const { call(context, begin, end, chunk); }
+
+private:
+	const void* context;
+	void (*call)(const void* context, size_t begin, size_t end, size_t chunk);
+	template <typename Body>
+	static void invoke(const void* context, size_t begin, size_t end, size_t chunk) { (*static_cast<const Body*>(context))(begin, end, chunk); }
+};
+
+size_t workerCount();	// Number of threads that parallelFor may use (at least 1)
+size_t parallelChunks(size_t count, size_t minChunkSize);	// Number of chunks parallelFor will split count items into
+void parallelFor(size_t count, size_t minChunkSize, const ChunkBody& body);	// Runs body on every chunk, the calling thread takes chunk 0
+
+// What parallelStableSort works in, kept by the caller so that sorts after the first of the same size don't allocate
+template <typename T>
+struct StableSortScratch {
+	std::vector<T> buffer;				// As big as the items, runs are merged back and forth between the two
+	std::vector<size_t> bounds, merged;	// Where the runs start, this round and the next
+};
+
+// Stable sort of [items, items + count) with buffer as room for as many, leaving the result in items. A merge sort of
+// short insertion sorted runs, which unlike std::stable_sort never allocates a buffer of its own
+template <typename T, typename Less>
+void stableSortRange(T* items, T* buffer, size_t count, Less less) {
+	const size_t RUN = 16;
+	for (size_t begin = 0; begin < count; begin += RUN) {
+		size_t end = std::min(begin + RUN, count);
+		for (size_t i = begin + 1; i < end; i++) {
+			T item = items[i];
+			size_t j = i;
+			for (; j > begin && less(item, items[j - 1]); j--) {
+				items[j] = items[j - 1];
+			}
+			items[j] = item;
+		}
+	}
+	T* from = items;
+	T* to = buffer;
+	for (size_t width = RUN; width < count; width *= 2) {
+		for (size_t begin = 0; begin < count; begin += 2 * width) {
+			size_t middle = std::min(begin + width, count), end = std::min(begin + 2 * width, count);
+			std::merge(from + begin, from + middle, from + middle, from + end, to + begin, less);
+		}
+		std::swap(from, to);
+	}
+	if (from != items) std::copy(from, from + count, items);
+}
+
+// Stable sort of items, sorting ranges on their own threads and then merging neighboring ranges pairwise, a round at a time.
+// Being stable, the order is the same however many threads did it
+template <typename T, typename Less>
+void parallelStableSort(std::vector<T>& items, StableSortScratch<T>& scratch, size_t minChunkSize, Less less) {
+	size_t chunks = parallelChunks(items.size(), minChunkSize);
+	if (chunks == 0) return;
+	scratch.buffer.resize(items.size());
+	std::vector<size_t>& bounds = scratch.bounds;	// Run r is [bounds[r], bounds[r + 1])
+	bounds.resize(chunks + 1);
+	for (size_t c = 0; c <= chunks; c++) {
+		bounds[c] = items.size() * c / chunks;
+	}
+	T* from = items.data();
+	T* to = scratch.buffer.data();
+	parallelFor(chunks, 1, [&](size_t first, size_t last, size_t) {
+		for (size_t c = first; c < last; c++) stableSortRange(from + bounds[c], to + bounds[c], bounds[c + 1] - bounds[c], less);
+	});
+	while (bounds.size() > 2) {
+		size_t runs = bounds.size() - 1;
+		parallelFor((runs + 1) / 2, 1, [&](size_t first, size_t last, size_t) {
+			for (size_t m = first; m < last; m++) {	// An odd run out has nothing to merge with and is only copied over
+				size_t begin = bounds[2 * m], middle = bounds[std::min(2 * m + 1, runs)], end = bounds[std::min(2 * m + 2, runs)];
+				std::merge(from + begin, from + middle, from + middle, from + end, to + begin, less);
+			}
+		});
+		scratch.merged.clear();
+		for (size_t b = 0; b < bounds.size(); b += 2) {
+			scratch.merged.push_back(bounds[b]);
+		}
+		if (scratch.merged.back() != bounds.back()) scratch.merged.push_back(bounds.back());
+		bounds.swap(scratch.merged);
+		std::swap(from, to);
+	}
+	if (from != items.data()) std::copy(from, from + items.size(), items.data());
+}
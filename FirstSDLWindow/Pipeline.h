@@ -0,0 +1,81 @@
+#pragma once
+#include "Object.h"
+#include "QuantizedBox.h"
+#include <cmath>
+#include <type_traits>
+
+// Compile time policies the collision pipeline is assembled from (see Game::collide)
+//	Every choice that used to be a flag test or a sortAxis branch inside the loops is a template parameter instead, so each
+//	configuration compiles to its own loop with nothing left to decide per object. Game picks one configuration per frame.
+
+// Sort axis policies, for sweep and prune
+struct AxisX {
+	static const char name = 'x';
+	static float min(const Object* object) { return object->AABB->center->x - object->AABB->radi[0]; }
+	static float max(const Object* object) { return object->AABB->center->x + object->AABB->radi[0]; }
+	static int min(const QuantizedBox& box) { return box.minX; }
+	static int max(const QuantizedBox& box) { return -box.negMaxX; }
+	static float min(const FatBox& box) { return box.minX; }
+	static float max(const FatBox& box) { return box.maxX; }
+};
+
+struct AxisY {
+	static const char name = 'y';
+	static float min(const Object* object) { return object->AABB->center->y - object->AABB->radi[1]; }
+	static float max(const Object* object) { return object->AABB->center->y + object->AABB->radi[1]; }
+	static int min(const QuantizedBox& box) { return box.minY; }
+	static int max(const QuantizedBox& box) { return -box.negMaxY; }
+	static float min(const FatBox& box) { return box.minY; }
+	static float max(const FatBox& box) { return box.maxY; }
+};
+
+// Narrowphase policies, do two objects touch?
+struct CircleNarrowphase {
+	static bool touching(const Object& a, const Object& b) {
+		float dx = a.pos.x - b.pos.x;
+		float dy = a.pos.y - b.pos.y;
+		float radiusSum = a.radius + b.radius;
+		return dx * dx + dy * dy <= radiusSum * radiusSum;
+	}
+};
+
+struct AABBNarrowphase {
+	static bool touching(const Object& a, const Object& b) {
+		if (std::abs(a.AABB->center->x - b.AABB->center->x) > (a.AABB->radi[0] + b.AABB->radi[0])) return false;
+		if (std::abs(a.AABB->center->y - b.AABB->center->y) > (a.AABB->radi[1] + b.AABB->radi[1])) return false;
+		return true;
+	}
+};
+
+// Response policies, what a touching pair does besides bouncing
+template <bool RecordContacts, bool Recolor>
+struct BounceResponse {
+	static const bool recordContacts = RecordContacts;	// Feeds the contact cache (CONTACT_EVENTS)
+	static const bool recolor = Recolor;				// Tints both objects, the brute force modes always have
+};
+
+// Broadphase policies, tags for the Game passes that produce candidate pairs
+struct NoBroadphase {};					// Moving objects only collide with static ones
+struct BruteForceBroadphase {};
+struct SweepAndPruneBroadphase {};
+struct VarianceSweepAndPruneBroadphase {};	// Sweep and prune that picks next frame's axis from this frame's spread
+struct UniformGridBroadphase {};
+struct LinearBVHBroadphase {};
+struct NeighborListBroadphase {};		// Reuses a Verlet neighbor list across frames (see NeighborList.h)
+
+template <class Broadphase>
+struct SortsAlongAxis : std::false_type {};	// Only these broadphases need a version for each axis
+template <>
+struct SortsAlongAxis<SweepAndPruneBroadphase> : std::true_type {};
+template <>
+struct SortsAlongAxis<VarianceSweepAndPruneBroadphase> : std::true_type {};
+
+template <class Broadphase>
+struct FindsStaticPairs : std::false_type {};	// Broadphases that produce the moving-static pairs too, the others query the static BVH
+template <>
+struct FindsStaticPairs<NeighborListBroadphase> : std::true_type {};
+
+template <class Axis>
+struct MinAlong {						// Orders objects by where their fat box starts along Axis
+	bool operator() (const Object* a, const Object* b) const { return Axis::min(a->fatBox) < Axis::min(b->fatBox); }
+};
@@ -0,0 +1,155 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <new>
+#include <utility>
+#include <cstdint>
+#include <algorithm>
+#include <type_traits>
+
+// Reference to an object in a Pool. The generation changes every time a slot is freed,
+// so a handle to a freed object can be detected instead of silently pointing at whatever reused the slot.
+struct Handle {
+	unsigned int index = INVALID_INDEX;
+	unsigned int generation = 0;
+	static const unsigned int INVALID_INDEX = 0xffffffff;
+
+	bool isValid() const { return index != INVALID_INDEX; }
+	bool operator== (const Handle& in) const { return index == in.index && generation == in.generation; }
+	bool operator!= (const Handle& in) const { return !(*this == in); }
+};
+
+// Fixed size object pool
+//	Slots are stored in blocks that are never moved or freed until the pool is destroyed, so pointers to the objects stay valid
+//	until reorder moves them. Handles go through their slot's location, so they stay valid through reorder too.
+//	Freed slots go on a free list and get reused first, so allocation and freeing are O(1) and long runs don't fragment.
+//	The bookkeeping for each slot lives in its own array, so the objects themselves sit back to back at their own alignment.
+template <typename T, unsigned int BLOCK_SIZE = 1024>
+class Pool {
+public:
+	Pool() {}
+	Pool(const Pool&) = delete;
+	Pool& operator= (const Pool&) = delete;
+	~Pool() {
+		for (unsigned int i = 0; i < capacity; i++) {	// Destroying everything that was never freed
+			if (getSlot(i).alive) getStorage(getSlot(i).location)->~T();
+		}
+	}
+
+	template <typename... Args>
+	Handle allocate(Args&&... args) {	// Constructs a new T with args and returns its handle
+		if (freeHead == Handle::INVALID_INDEX) grow();
+		unsigned int index = freeHead;
+		Slot& slot = getSlot(index);
+		freeHead = slot.nextFree;
+		new (getStorage(slot.location)) T(std::forward<Args>(args)...);
+		slot.alive = true;
+		count++;
+
+		Handle handle;
+		handle.index = index;
+		handle.generation = slot.generation;
+		return handle;
+	}
+
+	int free(Handle handle) {	// Returns 1 if the object was destroyed, 0 if the handle was already stale
+		T* object = get(handle);
+		if (object == NULL) return 0;
+		Slot& slot = getSlot(handle.index);
+		object->~T();
+		slot.alive = false;
+		slot.generation++;	// Every handle to this slot is now stale
+		slot.nextFree = freeHead;
+		freeHead = handle.index;
+		count--;
+		return 1;
+	}
+
+	T* get(Handle handle) const {	// Returns NULL for invalid or stale handles
+		if (handle.index >= capacity) return NULL;
+		Slot& slot = getSlot(handle.index);
+		if (!slot.alive || slot.generation != handle.generation) return NULL;
+		return getStorage(slot.location);
+	}
+
+	// Moves the objects behind order so they sit in memory in that order, in the storage the same objects took up before
+	//	Handles stay valid, pointers to the moved objects don't (T needs a move constructor). Every handle must be live and
+	//	appear once.
+	void reorder(const std::vector<Handle>& order) {
+		std::vector<unsigned int>& targets = reorderTargets;
+		std::vector<unsigned int>& sources = reorderSources;	// targets[i] gets the object now at sources[i]
+		targets.resize(order.size());
+		for (size_t i = 0; i < order.size(); i++) {
+			targets[i] = getSlot(order[i].index).location;
+		}
+		sources = targets;
+		std::sort(targets.begin(), targets.end());
+
+		// Following each cycle of the permutation with one object parked on the side
+		std::vector<bool>& done = reorderDone;
+		done.assign(order.size(), false);
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type parked;
+		T* spare = reinterpret_cast<T*>(&parked);
+		for (size_t start = 0; start < order.size(); start++) {
+			if (done[start] || sources[start] == targets[start]) continue;
+			new (spare) T(std::move(*getStorage(targets[start])));
+			getStorage(targets[start])->~T();
+			size_t current = start;
+			while (true) {
+				done[current] = true;
+				size_t next = std::lower_bound(targets.begin(), targets.end(), sources[current]) - targets.begin();	// Where the incoming object sits now
+				if (next == start) {
+					new (getStorage(targets[current])) T(std::move(*spare));
+					spare->~T();
+					break;
+				}
+				new (getStorage(targets[current])) T(std::move(*getStorage(targets[next])));
+				getStorage(targets[next])->~T();
+				current = next;
+			}
+		}
+		for (size_t i = 0; i < order.size(); i++) {
+			getSlot(order[i].index).location = targets[i];
+		}
+	}
+
+	size_t size() const { return count; }		// Number of live objects
+
+private:
+	struct Slot {
+		unsigned int generation = 0;
+		unsigned int nextFree = Handle::INVALID_INDEX;
+		unsigned int location = 0;	// Where the object lives in storage, starts out at the slot's own index
+		bool alive = false;
+	};
+	struct StorageBlock {	// Aligned by hand, plain new only guarantees alignment for the standard types before C++17
+		std::unique_ptr<unsigned char[]> memory;
+		unsigned char* objects;
+	};
+
+	std::vector<std::unique_ptr<Slot[]>> blocks;
+	std::vector<StorageBlock> storageBlocks;	// storageBlocks[i] holds the objects of blocks[i]
+	unsigned int capacity = 0;
+	unsigned int freeHead = Handle::INVALID_INDEX;
+	size_t count = 0;
+	std::vector<unsigned int> reorderTargets, reorderSources;	// Reused by reorder
+	std::vector<bool> reorderDone;
+
+	Slot& getSlot(unsigned int index) const { return blocks[index / BLOCK_SIZE][index % BLOCK_SIZE]; }
+	T* getStorage(unsigned int index) const { return reinterpret_cast<T*>(storageBlocks[index / BLOCK_SIZE].objects + (size_t)(index % BLOCK_SIZE) * sizeof(T)); }
+	void grow() {
+		blocks.emplace_back(new Slot[BLOCK_SIZE]);
+		StorageBlock storage;
+		storage.memory.reset(new unsigned char[sizeof(T) * BLOCK_SIZE + alignof(T)]);
+		uintptr_t address = reinterpret_cast<uintptr_t>(storage.memory.get());
+		storage.objects = storage.memory.get() + (alignof(T) - address % alignof(T)) % alignof(T);
+		storageBlocks.push_back(std::move(storage));
+		for (unsigned int i = BLOCK_SIZE; i > 0; i--) {	// Pushing in reverse so slots get handed out in ascending order
+			Slot& slot = blocks.back()[i - 1];
+			slot.location = capacity + i - 1;
+			slot.nextFree = freeHead;
+			freeHead = capacity + i - 1;
+		}
+		capacity += BLOCK_SIZE;
+	}
+};
@@ -0,0 +1,92 @@
+#pragma once
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define QUANTIZED_SSE
+#include <emmintrin.h>
+#endif
+
+// Quantized AABBs for the broadphases
+//	Bounds are stored as 15 bit integers on a grid laid over the scene, 8 bytes a box instead of 16 bytes of floats (or a
+//	pointer chase through the object). Mins are rounded down and maxes up, so two boxes that overlap always overlap quantized
+//	too; a quantized overlap can be a near miss, which the narrowphase then rejects.
+//	Maxes are stored negated. Testing box against another one's query form (maxes first, then negated mins) is then "every
+//	lane of box <= query", one signed 16 bit compare for all four sides.
+
+static const int QUANTIZED_MAX = 32767;
+
+struct QuantizedBox {
+	int16_t minX, minY;
+	int16_t negMaxX, negMaxY;
+};
+
+class BoxQuantizer {
+public:
+	void fit(float minX, float minY, float maxX, float maxY) {	// Lays the grid over [min, max], anything outside is clamped to its edges
+		originX = minX;
+		originY = minY;
+		scaleX = (maxX > minX) ? QUANTIZED_MAX / (maxX - minX) : 0;
+		scaleY = (maxY > minY) ? QUANTIZED_MAX / (maxY - minY) : 0;
+		stepX = (maxX - minX) / QUANTIZED_MAX;
+		stepY = (maxY - minY) / QUANTIZED_MAX;
+	}
+	QuantizedBox quantize(float minX, float minY, float maxX, float maxY) const {
+		QuantizedBox box;
+		box.minX = (int16_t)clamp(std::floor((minX - originX) * scaleX));
+		box.minY = (int16_t)clamp(std::floor((minY - originY) * scaleY));
+		box.negMaxX = (int16_t)-clamp(std::ceil((maxX - originX) * scaleX));
+		box.negMaxY = (int16_t)-clamp(std::ceil((maxY - originY) * scaleY));
+		return box;
+	}
+
+	// Back to scene coordinates, covering what was quantized up to float rounding
+	float minX(const QuantizedBox& box) const { return originX + box.minX * stepX; }
+	float minY(const QuantizedBox& box) const { return originY + box.minY * stepY; }
+	float maxX(const QuantizedBox& box) const { return originX - box.negMaxX * stepX; }
+	float maxY(const QuantizedBox& box) const { return originY - box.negMaxY * stepY; }
+
+private:
+	float originX = 0, originY = 0;
+	float scaleX = 0, scaleY = 0;	// Grid steps per unit
+	float stepX = 0, stepY = 0;		// Units per grid step
+
+	static int clamp(float value) {	// Also keeps values that overflow an int out of the cast
+		return (int)std::min(std::max(value, 0.0f), (float)QUANTIZED_MAX);
+	}
+};
+
+inline QuantizedBox queryBox(const QuantizedBox& box) {	// The form other boxes are tested against
+	QuantizedBox query;
+	query.minX = -box.negMaxX;
+	query.minY = -box.negMaxY;
+	query.negMaxX = -box.minX;
+	query.negMaxY = -box.minY;
+	return query;
+}
+
+inline bool boxesOverlap(const QuantizedBox& box, const QuantizedBox& query) {	// query comes from queryBox, touching counts as overlapping
+#ifdef QUANTIZED_SSE
+	__m128i a = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(&box));
+	__m128i b = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(&query));
+	return _mm_movemask_epi8(_mm_cmpgt_epi16(a, b)) == 0;	// The unused upper halves are zero in both and never compare greater
+#else
+	return box.minX <= query.minX && box.minY <= query.minY && box.negMaxX <= query.negMaxX && box.negMaxY <= query.negMaxY;
+#endif
+}
+
+inline QuantizedBox boxUnion(const QuantizedBox& a, const QuantizedBox& b) {	// With the maxes negated every side is a min
+#ifdef QUANTIZED_SSE
+	QuantizedBox box;
+	__m128i joined = _mm_min_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(&a)), _mm_loadl_epi64(reinterpret_cast<const __m128i*>(&b)));
+	_mm_storel_epi64(reinterpret_cast<__m128i*>(&box), joined);
+	return box;
+#else
+	QuantizedBox box;
+	box.minX = std::min(a.minX, b.minX);
+	box.minY = std::min(a.minY, b.minY);
+	box.negMaxX = std::min(a.negMaxX, b.negMaxX);
+	box.negMaxY = std::min(a.negMaxY, b.negMaxY);
+	return box;
+#endif
+}
@@ -0,0 +1,124 @@
+#include "Raycast.h"
+#include <algorithm>
+#include <cmath>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RAYCAST_SSE
+#include <emmintrin.h>
+#endif
+
+static const float BOX_EPSILON = 1e-3f;	// Boxes are grown this much so rays that run exactly along an edge still count as hitting them
+
+float safeInverse(float value) {
+	if (std::abs(value) < 1e-20f) value = (value < 0) ? -1e-20f : 1e-20f;
+	return 1.0f / value;
+}
+
+int rayHitsObject(const Ray& ray, const Object& object, float& t) {
+	vector o = vector(ray.origin.x, ray.origin.y) - object.pos;
+	vector d(ray.direction.x, ray.direction.y);
+	if (object.isCircle) {	// Solving |o + d * t| = radius
+		float a = d.dot(d);
+		float b = o.dot(d);
+		float c = o.dot(o) - object.radius * object.radius;
+		if (c <= 0) {	// Starting inside
+			t = 0;
+			return 1;
+		}
+		if (b >= 0 || a == 0) return 0;	// Pointing away
+		float discriminant = b * b - a * c;
+		if (discriminant < 0) return 0;
+		t = (-b - std::sqrt(discriminant)) / a;
+		return t <= ray.maxT;
+	}
+
+	// Everything else is treated as its bounding box
+	return rayHitsBox(ray, safeInverse(d.x), safeInverse(d.y), ray.maxT,
+		object.pos.x - object.radius, object.pos.y - object.radius, object.pos.x + object.radius, object.pos.y + object.radius, t);
+}
+
+int rayHitsBox(const Ray& ray, float inverseX, float inverseY, float maxT, float minX, float minY, float maxX, float maxY, float& entry) {
+	float x0 = (minX - BOX_EPSILON - ray.origin.x) * inverseX, x1 = (maxX + BOX_EPSILON - ray.origin.x) * inverseX;
+	float y0 = (minY - BOX_EPSILON - ray.origin.y) * inverseY, y1 = (maxY + BOX_EPSILON - ray.origin.y) * inverseY;
+	entry = std::max(std::max(std::min(x0, x1), std::min(y0, y1)), 0.0f);
+	float exit = std::min(std::min(std::max(x0, x1), std::max(y0, y1)), maxT);
+	return entry <= exit;
+}
+
+RaycastCollector::RaycastCollector(const Ray& ray, RaycastMode mode, std::vector<RaycastHit>& hits) : ray(ray), mode(mode), hits(hits) {
+	start = hits.size();
+	limit = ray.maxT;
+	found = false;
+}
+
+void RaycastCollector::test(Object* object) {
+	if (done() || !shouldCollide(ray.filter, object->filter)) return;
+	float t;
+	if (!rayHitsObject(ray, *object, t) || t > limit) return;
+
+	RaycastHit hit;
+	hit.object = object;
+	hit.t = t;
+	hit.point = vector(ray.origin.x, ray.origin.y) + vector(ray.direction.x, ray.direction.y) * t;
+	if (mode == RAYCAST_ALL) {
+		hits.push_back(hit);
+		return;
+	}
+	best = hit;
+	found = true;
+	if (mode == RAYCAST_CLOSEST) limit = t;	// Only closer hits matter from now on
+}
+
+float RaycastCollector::maxT() const {
+	return limit;
+}
+
+bool RaycastCollector::done() const {
+	return mode == RAYCAST_ANY && found;
+}
+
+int RaycastCollector::finish() {
+	if (mode != RAYCAST_ALL) {
+		if (!found) return 0;
+		hits.push_back(best);
+		return 1;
+	}
+
+	// Objects can be handed in more than once (e.g. when they span several grid cells)
+	auto first = hits.begin() + start;
+	std::sort(first, hits.end(), [](const RaycastHit& a, const RaycastHit& b) { return a.object < b.object; });
+	hits.erase(std::unique(first, hits.end(), [](const RaycastHit& a, const RaycastHit& b) { return a.object == b.object; }), hits.end());
+	std::sort(hits.begin() + start, hits.end(), [](const RaycastHit& a, const RaycastHit& b) { return a.t < b.t; });
+	return (int)(hits.size() - start);
+}
+
+void RayPacket::set(int lane, const Ray& ray, float maxT) {
+	originX[lane] = ray.origin.x;
+	originY[lane] = ray.origin.y;
+	inverseX[lane] = safeInverse(ray.direction.x);
+	inverseY[lane] = safeInverse(ray.direction.y);
+	this->maxT[lane] = maxT;
+}
+
+int RayPacket::slabTest(float minX, float minY, float maxX, float maxY) const {
+#ifdef RAYCAST_SSE
+	__m128 ox = _mm_loadu_ps(originX), oy = _mm_loadu_ps(originY);
+	__m128 ix = _mm_loadu_ps(inverseX), iy = _mm_loadu_ps(inverseY);
+	__m128 x0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(minX - BOX_EPSILON), ox), ix);
+	__m128 x1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(maxX + BOX_EPSILON), ox), ix);
+	__m128 y0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(minY - BOX_EPSILON), oy), iy);
+	__m128 y1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(maxY + BOX_EPSILON), oy), iy);
+	__m128 entry = _mm_max_ps(_mm_max_ps(_mm_min_ps(x0, x1), _mm_min_ps(y0, y1)), _mm_setzero_ps());
+	__m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(x0, x1), _mm_max_ps(y0, y1)), _mm_loadu_ps(maxT));
+	return _mm_movemask_ps(_mm_cmple_ps(entry, exit));
+#else
+	int mask = 0;
+	for (int lane = 0; lane < 4; lane++) {
+		float x0 = (minX - BOX_EPSILON - originX[lane]) * inverseX[lane], x1 = (maxX + BOX_EPSILON - originX[lane]) * inverseX[lane];
+		float y0 = (minY - BOX_EPSILON - originY[lane]) * inverseY[lane], y1 = (maxY + BOX_EPSILON - originY[lane]) * inverseY[lane];
+		float entry = std::max(std::max(std::min(x0, x1), std::min(y0, y1)), 0.0f);
+		float exit = std::min(std::min(std::max(x0, x1), std::max(y0, y1)), maxT[lane]);
+		if (entry <= exit) mask |= 1 << lane;
+	}
+	return mask;
+#endif
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include "Object.h"
+#include <vector>
+#include <limits>
+
+// Ray and segment casting
+//	A ray hits every point origin + direction * t with 0 <= t <= maxT.
+//	A segment from a to b is the ray with origin a, direction b - a and maxT 1.
+
+enum RaycastMode {
+	RAYCAST_CLOSEST,	// Only the first object along the ray
+	RAYCAST_ANY,		// Whatever object is found first, for line of sight checks
+	RAYCAST_ALL			// Every object along the ray, closest first
+};
+
+struct Ray {
+	vector origin;
+	vector direction;		// Doesn't need to be normalized, t is measured in multiples of it
+	float maxT = std::numeric_limits<float>::infinity();
+	CollisionFilter filter;	// Objects whose filter doesn't collide with this one are passed through (e.g. the shooter's own team)
+};
+
+struct RaycastHit {
+	Object* object;
+	float t;
+	vector point;
+};
+
+int rayHitsObject(const Ray& ray, const Object& object, float& t);	// Returns 1 and where the ray enters the object (0 if it starts inside)
+float safeInverse(float value);										// 1 / value, without infinities for axis aligned rays
+int rayHitsBox(const Ray& ray, float inverseX, float inverseY, float maxT, float minX, float minY, float maxX, float maxY, float& entry);	// Slab test against a box
+
+// Collects the hits of one ray according to the mode. Broadphases feed it candidates through test().
+class RaycastCollector {
+public:
+	RaycastCollector(const Ray& ray, RaycastMode mode, std::vector<RaycastHit>& hits);
+	void test(Object* object);		// Runs the filter and the narrowphase and records a hit
+	float maxT() const;				// Hits past this can be skipped (shrinks as closer hits are found)
+	bool done() const;				// Nothing more can change the result
+	int finish();					// Appends the results to hits, returns how many were added
+	const Ray& ray;
+
+private:
+	RaycastMode mode;
+	std::vector<RaycastHit>& hits;
+	size_t start;
+	float limit;
+	bool found;
+	RaycastHit best;
+};
+
+// Four rays for SIMD slab tests
+struct RayPacket {
+	float originX[4], originY[4];
+	float inverseX[4], inverseY[4];
+	float maxT[4];		// Lanes that are finished or unused have a negative maxT, so they never hit anything
+
+	void set(int lane, const Ray& ray, float maxT);
+	int slabTest(float minX, float minY, float maxX, float maxY) const;	// Bit i is set if ray i hits the box
+};
@@ -0,0 +1,84 @@
+#pragma once
+#include "Object.h"
+#include <cstddef>
+#include <vector>
+
+// What the renderer needs from one frame of the simulation, copied out so it can be drawn while the next frame runs
+enum RenderColliderState : unsigned char {
+	RENDER_NO_COLLIDER,			// Nothing drawn besides the object
+	RENDER_COLLIDER,			// Collider outline in the default color
+	RENDER_OVERLAPPING,			// The collider overlapped another one this frame
+	RENDER_COLLIDING			// The object collided this frame
+};
+
+struct Camera {
+	float x = 0, y = 0;			// World position shown at the center of the window
+	float zoom = 1;				// Screen pixels per world unit
+};
+
+struct RenderItem {				// In world units, the camera is applied when drawing
+	float x, y;
+	float radius;
+	float halfWidth, halfHeight;	// Collider half extents, only meaningful with a collider state
+	Color color = Color(255, 255, 255, 255);
+	bool isCircle = true;		// Points are drawn as a single pixel
+	RenderColliderState collider = RENDER_NO_COLLIDER;
+};
+
+struct RenderTile {				// Level of detail stand in for objects too small or too crowded to draw one by one
+	SDL_Rect rect;				// In screen pixels
+	Color color = Color(255, 255, 255, 255);	// Average color of the objects, alpha is how much of the tile they cover
+};
+
+struct RenderPalette {			// Colors that depend on the game rather than on the objects
+	Color background = Color(0, 0, 0, 0);
+	Color collider = Color(0, 255, 0, 255);
+	Color collision = Color(255, 0, 0, 255);
+	Color overlap = Color(0, 100, 128, 255);
+};
+
+struct RenderState {
+	Camera camera;				// The view items were culled against
+	int width = 0, height = 0;	// Screen size in pixels
+	std::vector<RenderItem> items;	// Only objects in view, moving ones first and then static ones
+	std::vector<RenderTile> tiles;
+	size_t frame = 0;
+};
+
+// Draws a frame onto anything with point, rect, circle and fill (BatchRenderer on screen, OffscreenRenderer in memory)
+//	Everything that decides how the scene looks lives here, so every target draws the same picture.
+template <typename Canvas>
+void drawFrame(const RenderState& state, const RenderPalette& palette, Canvas& canvas) {
+	for (auto& tile : state.tiles) {
+		canvas.fill(tile.rect, tile.color);
+	}
+	float zoom = state.camera.zoom;
+	float offsetX = state.width / 2.0f - state.camera.x * zoom;	// World to screen is position * zoom + offset
+	float offsetY = state.height / 2.0f - state.camera.y * zoom;
+	for (auto& item : state.items) {
+		float x = item.x * zoom + offsetX;
+		float y = item.y * zoom + offsetY;
+		if (!item.isCircle) {	// Is the object just a point or a circle?
+			canvas.point((int)x, (int)y, item.color);
+			continue;
+		}
+		canvas.circle(x, y, item.radius * zoom, item.color);
+		if (item.collider == RENDER_NO_COLLIDER) continue;
+
+		// Drawing colliders
+		const Color* color = &palette.collider;	// Default color for no collisions or overlap
+		if (item.collider == RENDER_COLLIDING) {
+			color = &palette.collision;			// Red if colliding
+		}
+		else if (item.collider == RENDER_OVERLAPPING) {
+			color = &palette.overlap;			// Light blue if overlapping
+		}
+		SDL_Rect rect;
+		rect.x = (int)(x - item.halfWidth * zoom);	// Same rounding as AxisAlignedBoundingBox::toSDLRect
+		rect.y = (int)(y - item.halfHeight * zoom);
+		rect.w = (int)(item.halfWidth * zoom * 2);
+		rect.h = (int)(item.halfHeight * zoom * 2);
+		canvas.point((int)x, (int)y, *color);	// Drawing the center of the collider
+		canvas.rect(rect, *color);
+	}
+}
@@ -0,0 +1,260 @@
+#include "Replay.h"
+#include <cstddef>
+#include <cstring>
+
+struct ReplayHeader {
+	uint32_t magic;
+	uint32_t version;
+	int32_t flags;
+	uint32_t frameCount;	// Written when the recording is closed, a log that was cut off has 0 here and is replayed as far as it goes
+};
+
+static uint32_t floatBits(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+static float bitsFloat(uint32_t bits) {
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+static uint32_t zigzag(int32_t value) {	// Small negative numbers become small positive ones, so they stay short as varints
+	return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value) {
+	return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static uint32_t packColor(const Color& color) {
+	return color.r | (color.g << 8) | (color.b << 16) | ((uint32_t)color.a << 24);
+}
+
+static void putVarint(std::vector<unsigned char>& out, uint64_t value) {	// 7 bits per byte, the high bit says more follow
+	while (value >= 0x80) {
+		out.push_back((unsigned char)(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back((unsigned char)value);
+}
+
+static void putFloat(std::vector<unsigned char>& out, float value, float previous) {
+	putVarint(out, floatBits(value) ^ floatBits(previous));
+}
+
+// Reading keeps going after running off the end (returning zeros) and only reports it through ok, so the callers stay linear
+struct VarintReader {
+	const unsigned char* data;
+	size_t size;
+	size_t& cursor;
+	bool ok;
+
+	uint64_t next() {
+		uint64_t value = 0;
+		for (int shift = 0; shift < 64; shift += 7) {
+			if (cursor >= size) {
+				ok = false;
+				return 0;
+			}
+			unsigned char byte = data[cursor++];
+			value |= (uint64_t)(byte & 0x7f) << shift;
+			if ((byte & 0x80) == 0) return value;
+		}
+		ok = false;
+		return 0;
+	}
+	float nextFloat(float previous) {
+		return bitsFloat((uint32_t)next() ^ floatBits(previous));
+	}
+};
+
+void ReplayFrame::clear() {
+	deltaTime = 0;
+	spawns.clear();
+	despawns.clear();
+	forces.clear();
+	checksum = 0;
+}
+
+ReplayWriter::~ReplayWriter() {
+	close();
+}
+
+int ReplayWriter::open(const char* path, int flags) {
+	close();
+	file = fopen(path, "wb");
+	if (file == NULL) return 0;
+	frameCount = 0;
+	failed = false;
+	lastSpawn = ReplaySpawn();
+	lastDeltaTime = 0;
+	lastForce = vector();
+	ReplayHeader header;
+	header.magic = REPLAY_MAGIC;
+	header.version = REPLAY_VERSION;
+	header.flags = flags;
+	header.frameCount = 0;
+	failed = (fwrite(&header, sizeof(header), 1, file) != 1);
+	return !failed;
+}
+
+int ReplayWriter::writeFrame(const ReplayFrame& frame) {
+	if (file == NULL) return 0;
+	buffer.clear();
+	uint32_t deltaTime = floatBits(frame.deltaTime);
+	putVarint(buffer, deltaTime ^ lastDeltaTime);	// A steady timestep costs one byte
+	lastDeltaTime = deltaTime;
+
+	putVarint(buffer, frame.spawns.size());
+	for (auto& spawn : frame.spawns) {
+		buffer.push_back((unsigned char)((spawn.isStatic ? 1 : 0) | (spawn.isVisible ? 2 : 0)));
+		putFloat(buffer, spawn.pos.x, lastSpawn.pos.x);
+		putFloat(buffer, spawn.pos.y, lastSpawn.pos.y);
+		putFloat(buffer, spawn.vel.x, lastSpawn.vel.x);
+		putFloat(buffer, spawn.vel.y, lastSpawn.vel.y);
+		putFloat(buffer, spawn.acc.x, lastSpawn.acc.x);
+		putFloat(buffer, spawn.acc.y, lastSpawn.acc.y);
+		putFloat(buffer, spawn.radius, lastSpawn.radius);
+		putVarint(buffer, zigzag(spawn.mass - lastSpawn.mass));
+		putVarint(buffer, packColor(spawn.color) ^ packColor(lastSpawn.color));
+		putVarint(buffer, spawn.filter.category ^ lastSpawn.filter.category);
+		putVarint(buffer, spawn.filter.mask ^ lastSpawn.filter.mask);
+		putVarint(buffer, zigzag(spawn.filter.group - lastSpawn.filter.group));
+		lastSpawn = spawn;
+	}
+
+	putVarint(buffer, frame.despawns.size());
+	uint32_t lastIndex = 0;
+	for (auto index : frame.despawns) {	// Ascending, so only the gaps are stored
+		putVarint(buffer, index - lastIndex);
+		lastIndex = index;
+	}
+
+	putVarint(buffer, frame.forces.size());
+	lastIndex = 0;
+	for (auto& force : frame.forces) {
+		putVarint(buffer, zigzag((int32_t)(force.index - lastIndex)));
+		putFloat(buffer, force.force.x, lastForce.x);
+		putFloat(buffer, force.force.y, lastForce.y);
+		lastIndex = force.index;
+		lastForce = vector(force.force.x, force.force.y);
+	}
+
+	for (int i = 0; i < 8; i++) {
+		buffer.push_back((unsigned char)(frame.checksum >> (i * 8)));
+	}
+	if (fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size()) failed = true;
+	frameCount++;
+	return !failed;
+}
+
+int ReplayWriter::close() {
+	if (file == NULL) return 0;
+	if (fseek(file, offsetof(ReplayHeader, frameCount), SEEK_SET) != 0 || fwrite(&frameCount, sizeof(frameCount), 1, file) != 1) failed = true;
+	if (fclose(file) != 0) failed = true;
+	file = NULL;
+	return !failed;
+}
+
+bool ReplayWriter::isOpen() const {
+	return file != NULL;
+}
+
+int ReplayReader::open(const char* path) {
+	data.clear();
+	cursor = 0;
+	frames = 0;
+	framesRead = 0;
+	lastSpawn = ReplaySpawn();
+	lastDeltaTime = 0;
+	lastForce = vector();
+	FILE* file = fopen(path, "rb");
+	if (file == NULL) return 0;
+	unsigned char chunk[1 << 16];
+	size_t read;
+	while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+		data.insert(data.end(), chunk, chunk + read);
+	}
+	fclose(file);
+
+	ReplayHeader header;
+	if (data.size() < sizeof(header)) return 0;
+	memcpy(&header, data.data(), sizeof(header));
+	if (header.magic != REPLAY_MAGIC || header.version != REPLAY_VERSION) return 0;
+	flags = header.flags;
+	frames = header.frameCount;
+	cursor = sizeof(header);
+	return 1;
+}
+
+int ReplayReader::readFrame(ReplayFrame& frame) {
+	frame.clear();
+	if (cursor >= data.size() || (frames != 0 && framesRead >= frames)) return 0;
+	VarintReader in = { data.data(), data.size(), cursor, true };
+	lastDeltaTime ^= (uint32_t)in.next();
+	frame.deltaTime = bitsFloat(lastDeltaTime);
+
+	size_t spawnCount = (size_t)in.next();
+	for (size_t i = 0; i < spawnCount && in.ok; i++) {
+		ReplaySpawn spawn;
+		unsigned char state = (cursor < data.size()) ? data[cursor++] : 0;
+		spawn.isStatic = (state & 1) != 0;
+		spawn.isVisible = (state & 2) != 0;
+		spawn.pos.x = in.nextFloat(lastSpawn.pos.x);
+		spawn.pos.y = in.nextFloat(lastSpawn.pos.y);
+		spawn.vel.x = in.nextFloat(lastSpawn.vel.x);
+		spawn.vel.y = in.nextFloat(lastSpawn.vel.y);
+		spawn.acc.x = in.nextFloat(lastSpawn.acc.x);
+		spawn.acc.y = in.nextFloat(lastSpawn.acc.y);
+		spawn.radius = in.nextFloat(lastSpawn.radius);
+		spawn.mass = lastSpawn.mass + unzigzag((uint32_t)in.next());
+		uint32_t color = packColor(lastSpawn.color) ^ (uint32_t)in.next();
+		spawn.color = Color(color & 0xff, (color >> 8) & 0xff, (color >> 16) & 0xff, color >> 24);
+		spawn.filter.category = lastSpawn.filter.category ^ (uint32_t)in.next();
+		spawn.filter.mask = lastSpawn.filter.mask ^ (uint32_t)in.next();
+		spawn.filter.group = lastSpawn.filter.group + unzigzag((uint32_t)in.next());
+		frame.spawns.push_back(spawn);
+		lastSpawn = spawn;
+	}
+
+	size_t despawnCount = (size_t)in.next();
+	uint32_t index = 0;
+	for (size_t i = 0; i < despawnCount && in.ok; i++) {
+		index += (uint32_t)in.next();
+		frame.despawns.push_back(index);
+	}
+
+	size_t forceCount = (size_t)in.next();
+	index = 0;
+	for (size_t i = 0; i < forceCount && in.ok; i++) {
+		ReplayForce force;
+		index += (uint32_t)unzigzag((uint32_t)in.next());
+		force.index = index;
+		force.force.x = in.nextFloat(lastForce.x);
+		force.force.y = in.nextFloat(lastForce.y);
+		frame.forces.push_back(force);
+		lastForce = vector(force.force.x, force.force.y);
+	}
+
+	if (!in.ok || data.size() - cursor < 8) {
+		cursor = data.size();	// Nothing after a damaged frame can be trusted
+		return 0;
+	}
+	frame.checksum = 0;
+	for (int i = 0; i < 8; i++) {
+		frame.checksum |= (uint64_t)data[cursor++] << (i * 8);
+	}
+	framesRead++;
+	return 1;
+}
+
+int ReplayReader::recordedFlags() const {
+	return flags;
+}
+
+uint32_t ReplayReader::frameCount() const {
+	return frames;
+}
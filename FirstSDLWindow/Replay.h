@@ -0,0 +1,75 @@
+#pragma once
+#include "Object.h"
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// Deterministic replays
+//	A recording is a snapshot of the scene when recording started (path + ".snap", see Snapshot.h) plus a log of every
+//	frame's inputs: the timestep, the objects spawned, the ones despawned and the forces applied. Objects are referred to by
+//	replay index, the order they appear in the snapshot and then the order they were spawned in, so ids don't need to match.
+//	Frames are delta encoded against the previous values (floats as XORed bits) and written as varints, so a frame where
+//	nothing happens is the timestep, three counts and the checksum.
+
+static const uint32_t REPLAY_MAGIC = 0x594c5052;	// "RPLY" in a little endian file
+static const uint32_t REPLAY_VERSION = 1;
+
+struct ReplaySpawn {				// Everything about a new object, as it was when the spawn was applied
+	vector pos, vel, acc;
+	float radius = 0;
+	int mass = 1;
+	Color color = Color(255, 255, 255, 255);
+	CollisionFilter filter;
+	bool isStatic = false;
+	bool isVisible = true;
+};
+
+struct ReplayForce {
+	uint32_t index;
+	vector force;
+};
+
+struct ReplayFrame {
+	float deltaTime = 0;
+	std::vector<ReplaySpawn> spawns;	// Get the next replay indices in this order
+	std::vector<uint32_t> despawns;		// Ascending
+	std::vector<ReplayForce> forces;
+	uint64_t checksum = 0;				// Of the moving objects after the update, see Game::stateChecksum
+
+	void clear();
+};
+
+class ReplayWriter {
+public:
+	~ReplayWriter();
+	int open(const char* path, int flags);	// flags are the recording game's flags, returns 0 if the file can't be created
+	int writeFrame(const ReplayFrame& frame);
+	int close();							// Finishes the header, returns 1 if everything was written
+	bool isOpen() const;
+
+private:
+	FILE* file = NULL;
+	uint32_t frameCount = 0;
+	bool failed = false;
+	ReplaySpawn lastSpawn;				// Previous values everything is delta encoded against
+	uint32_t lastDeltaTime = 0;
+	vector lastForce;
+	std::vector<unsigned char> buffer;
+};
+
+class ReplayReader {
+public:
+	int open(const char* path);			// Reads the whole log, returns 0 if it is missing or isn't a replay of this version
+	int readFrame(ReplayFrame& frame);	// Returns 0 once every frame has been read (or the log is damaged)
+	int recordedFlags() const;
+	uint32_t frameCount() const;
+
+private:
+	std::vector<unsigned char> data;
+	size_t cursor = 0;
+	int flags = 0;
+	uint32_t frames = 0, framesRead = 0;
+	ReplaySpawn lastSpawn;
+	uint32_t lastDeltaTime = 0;
+	vector lastForce;
+};
@@ -0,0 +1,230 @@
+#include "Snapshot.h"
+#include <cstring>
+#include <algorithm>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const uint64_t CHUNK_ALIGNMENT = 64;	// Payloads start on cache lines, so columns can be used in place with aligned loads
+
+static uint64_t alignUp(uint64_t value) {
+	return (value + CHUNK_ALIGNMENT - 1) & ~(CHUNK_ALIGNMENT - 1);
+}
+
+Snapshot::Snapshot() {
+	data = NULL;
+	size = 0;
+	chunks = NULL;
+	chunkCount = 0;
+	fileHandle = NULL;
+	mappingHandle = NULL;
+	fileDescriptor = -1;
+}
+
+Snapshot::~Snapshot() {
+	close();
+}
+
+int Snapshot::open(const char* path) {
+	close();
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE) return 0;
+	fileHandle = file;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart < (LONGLONG)sizeof(SnapshotHeader)) {
+		close();
+		return 0;
+	}
+	mappingHandle = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mappingHandle == NULL) {
+		close();
+		return 0;
+	}
+	data = static_cast<const unsigned char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+	size = (size_t)fileSize.QuadPart;
+#else
+	fileDescriptor = ::open(path, O_RDONLY);
+	if (fileDescriptor == -1) return 0;
+	struct stat info;
+	if (fstat(fileDescriptor, &info) != 0 || info.st_size < (off_t)sizeof(SnapshotHeader)) {
+		close();
+		return 0;
+	}
+	void* mapped = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+	data = (mapped == MAP_FAILED) ? NULL : static_cast<const unsigned char*>(mapped);
+	size = (size_t)info.st_size;
+#endif
+	if (data == NULL) {
+		close();
+		return 0;
+	}
+
+	// Checking the header and that every chunk lies inside the file
+	const SnapshotHeader* header = reinterpret_cast<const SnapshotHeader*>(data);
+	uint64_t tableEnd = sizeof(SnapshotHeader) + (uint64_t)header->chunkCount * sizeof(SnapshotChunk);
+	if (header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION || header->fileSize != size || tableEnd > size) {
+		close();
+		return 0;
+	}
+	chunks = reinterpret_cast<const SnapshotChunk*>(data + sizeof(SnapshotHeader));
+	chunkCount = header->chunkCount;
+	for (size_t i = 0; i < chunkCount; i++) {
+		const SnapshotChunk& chunk = chunks[i];
+		if (chunk.offset < tableEnd || chunk.offset > size || chunk.elementSize == 0 ||
+			chunk.count > (size - chunk.offset) / chunk.elementSize) {
+			close();
+			return 0;
+		}
+	}
+	return 1;
+}
+
+void Snapshot::close() {
+#ifdef _WIN32
+	if (data != NULL) UnmapViewOfFile(data);
+	if (mappingHandle != NULL) CloseHandle(mappingHandle);
+	if (fileHandle != NULL) CloseHandle(fileHandle);
+#else
+	if (data != NULL) munmap(const_cast<unsigned char*>(data), size);
+	if (fileDescriptor != -1) ::close(fileDescriptor);
+#endif
+	data = NULL;
+	size = 0;
+	chunks = NULL;
+	chunkCount = 0;
+	fileHandle = NULL;
+	mappingHandle = NULL;
+	fileDescriptor = -1;
+}
+
+const void* Snapshot::chunk(uint32_t type, size_t elementSize, size_t& count) const {
+	count = 0;
+	for (size_t i = 0; i < chunkCount; i++) {
+		if (chunks[i].type != type) continue;
+		if (chunks[i].elementSize != elementSize) return NULL;
+		count = (size_t)chunks[i].count;
+		return data + chunks[i].offset;
+	}
+	return NULL;
+}
+
+SnapshotWriter::~SnapshotWriter() {
+	clear();
+}
+
+void* SnapshotWriter::addChunk(uint32_t type, size_t elementSize, size_t count) {
+	pending.push_back(PendingChunk());
+	PendingChunk& chunk = pending.back();
+	chunk.info.type = type;
+	chunk.info.elementSize = (uint32_t)elementSize;
+	chunk.info.count = count;
+	chunk.info.offset = 0;
+	chunk.bytes.resize(elementSize * count);
+	return chunk.bytes.data();
+}
+
+int SnapshotWriter::begin(const char* path) {
+	if (file != NULL) fail();
+	finalPath = path;
+	tempPath = finalPath + ".tmp";
+	file = fopen(tempPath.c_str(), "wb");
+	if (file == NULL) {
+		pending.clear();
+		return 0;
+	}
+
+	// Laying out the payloads, the chunk table can then be written up front
+	uint64_t offset = sizeof(SnapshotHeader) + pending.size() * sizeof(SnapshotChunk);
+	for (auto& chunk : pending) {
+		offset = alignUp(offset);
+		chunk.info.offset = offset;
+		offset += chunk.bytes.size();
+	}
+	fileSize = offset;
+
+	SnapshotHeader blank;	// Left zeroed until the end, so an unfinished file never passes as a snapshot
+	memset(&blank, 0, sizeof(blank));
+	if (fwrite(&blank, sizeof(blank), 1, file) != 1) return fail();
+	for (auto& chunk : pending) {
+		if (fwrite(&chunk.info, sizeof(SnapshotChunk), 1, file) != 1) return fail();
+	}
+	currentChunk = 0;
+	currentOffset = 0;
+	position = sizeof(SnapshotHeader) + pending.size() * sizeof(SnapshotChunk);
+	return 1;
+}
+
+int SnapshotWriter::writeSome(size_t maxBytes) {
+	if (file == NULL) return 0;
+	static const unsigned char zeros[CHUNK_ALIGNMENT] = {};
+	size_t written = 0;
+	while (currentChunk < pending.size() && written < maxBytes) {
+		PendingChunk& chunk = pending[currentChunk];
+		if (currentOffset == 0) {	// Padding up to the start of the payload
+			size_t padding = (size_t)(chunk.info.offset - position);
+			if (padding > 0 && fwrite(zeros, 1, padding, file) != padding) return fail();
+			position += padding;
+		}
+		size_t amount = std::min(chunk.bytes.size() - currentOffset, maxBytes - written);
+		if (amount > 0 && fwrite(chunk.bytes.data() + currentOffset, 1, amount, file) != amount) return fail();
+		currentOffset += amount;
+		position += amount;
+		written += amount;
+		if (currentOffset == chunk.bytes.size()) {
+			std::vector<unsigned char>().swap(chunk.bytes);	// Written chunks give their memory back right away
+			currentChunk++;
+			currentOffset = 0;
+		}
+	}
+	if (currentChunk < pending.size()) return 0;
+	return complete();
+}
+
+int SnapshotWriter::finish() {
+	return writeSome((size_t)-1);
+}
+
+bool SnapshotWriter::isWriting() const {
+	return file != NULL;
+}
+
+void SnapshotWriter::clear() {
+	if (file != NULL) fail();
+	pending.clear();	// Chunks can be added without ever calling begin
+}
+
+int SnapshotWriter::fail() {
+	fclose(file);
+	file = NULL;
+	pending.clear();
+	remove(tempPath.c_str());
+	return 0;
+}
+
+int SnapshotWriter::complete() {
+	SnapshotHeader header;
+	header.magic = SNAPSHOT_MAGIC;
+	header.version = SNAPSHOT_VERSION;
+	header.chunkCount = (uint32_t)pending.size();
+	header.padding = 0;
+	header.fileSize = fileSize;
+	if (fflush(file) != 0 || fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, file) != 1) return fail();
+	int closed = fclose(file);
+	file = NULL;
+	pending.clear();
+	if (closed != 0) {
+		remove(tempPath.c_str());
+		return 0;
+	}
+	remove(finalPath.c_str());	// rename won't replace an existing file on Windows
+	return rename(tempPath.c_str(), finalPath.c_str()) == 0;
+}
@@ -0,0 +1,132 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Binary scene snapshots
+//	A snapshot file is a header, a table of chunks and then the chunk payloads, each starting on a 64 byte boundary.
+//	Object state is stored one column per chunk (every x position, then every y position, ...), so a loader reads each
+//	column straight out of the memory mapped file without parsing anything. Readers skip chunk types they don't know.
+//	The header is written last, so a file that was cut off part way through is rejected instead of loading garbage.
+
+static const uint32_t SNAPSHOT_MAGIC = 0x50414e53;	// "SNAP" in a little endian file
+static const uint32_t SNAPSHOT_VERSION = 1;
+
+enum SnapshotChunkType : uint32_t {
+	SNAPSHOT_SCENE = 1,				// One SnapshotScene
+	SNAPSHOT_POSITION_X,			// float per object, moving objects first and then static ones
+	SNAPSHOT_POSITION_Y,
+	SNAPSHOT_VELOCITY_X,
+	SNAPSHOT_VELOCITY_Y,
+	SNAPSHOT_ACCELERATION_X,
+	SNAPSHOT_ACCELERATION_Y,
+	SNAPSHOT_RADIUS,				// float per object
+	SNAPSHOT_MASS,					// int32_t per object
+	SNAPSHOT_COLOR,					// uint32_t per object, r in the lowest byte
+	SNAPSHOT_STATE,					// uint8_t per object, SnapshotStateBits
+	SNAPSHOT_ID,					// uint64_t per object
+	SNAPSHOT_FILTER_CATEGORY,		// uint32_t per object
+	SNAPSHOT_FILTER_MASK,			// uint32_t per object
+	SNAPSHOT_FILTER_GROUP,			// int32_t per object
+	SNAPSHOT_COLLIDER_HALF_WIDTH,	// float per object, AABB half extents
+	SNAPSHOT_COLLIDER_HALF_HEIGHT,
+	SNAPSHOT_STATIC_BVH_NODES,		// StaticBVH::Node per node
+	SNAPSHOT_STATIC_BVH_ITEMS		// uint32_t per leaf slot, index into the static objects (SNAPSHOT_NO_ITEM for holes)
+};
+
+enum SnapshotStateBits : uint8_t {
+	SNAPSHOT_STATIC		= 1 << 0,
+	SNAPSHOT_CIRCLE		= 1 << 1,
+	SNAPSHOT_VISIBLE	= 1 << 2
+};
+
+static const uint32_t SNAPSHOT_NO_ITEM = 0xffffffff;
+
+struct SnapshotScene {
+	int32_t width, height;
+	int32_t flags;				// Flags of the game that wrote the snapshot, only informational
+	int32_t sortedAxis;			// Sweep and prune axis the moving objects are sorted along (0 if they aren't)
+	uint64_t dynamicCount;		// Objects [0, dynamicCount) move, the next staticCount don't
+	uint64_t staticCount;
+	uint64_t totalFrames;
+	uint64_t nextId;			// Id the next spawned object gets
+	int32_t staticRoot;			// Root of the saved static BVH (-1 if it was empty)
+	int32_t sortAxis;			// Axis the next sweep and prune sort uses, variance sweep and prune picks it from the last frame
+};
+
+struct SnapshotHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t chunkCount;		// SnapshotChunk entries right after the header
+	uint32_t padding;
+	uint64_t fileSize;
+};
+
+struct SnapshotChunk {
+	uint32_t type;
+	uint32_t elementSize;
+	uint64_t count;
+	uint64_t offset;			// From the start of the file
+};
+
+// Read only view of a snapshot file, the data stays in the mapping until close
+class Snapshot {
+public:
+	Snapshot();
+	~Snapshot();
+	Snapshot(const Snapshot&) = delete;
+	Snapshot& operator= (const Snapshot&) = delete;
+
+	int open(const char* path);	// Maps the file, returns 0 if it is missing or isn't a complete snapshot of this version
+	void close();
+	const void* chunk(uint32_t type, size_t elementSize, size_t& count) const;	// NULL if the chunk is missing or its elements have a different size
+	template <typename T>
+	const T* chunk(uint32_t type, size_t& count) const {
+		return static_cast<const T*>(chunk(type, sizeof(T), count));
+	}
+
+private:
+	const unsigned char* data;
+	size_t size;
+	const SnapshotChunk* chunks;
+	size_t chunkCount;
+	void* fileHandle;			// HANDLE on Windows
+	void* mappingHandle;
+	int fileDescriptor;			// Everywhere else
+};
+
+// Writes a snapshot a piece at a time, so a big scene can be saved during a run without stalling a frame
+//	The chunks are copied in when they are added, after that the scene can keep changing while the file is written.
+//	The file is written to path + ".tmp" and only renamed to path once it is complete.
+class SnapshotWriter {
+public:
+	~SnapshotWriter();	// An unfinished snapshot is abandoned
+	void* addChunk(uint32_t type, size_t elementSize, size_t count);	// Returns count * elementSize bytes for the caller to fill
+	template <typename T>
+	T* addChunk(uint32_t type, size_t count) {
+		return static_cast<T*>(addChunk(type, sizeof(T), count));
+	}
+	int begin(const char* path);	// Starts writing the added chunks, returns 0 if the file can't be created (the chunks are dropped)
+	int writeSome(size_t maxBytes);	// Writes up to about maxBytes more, returns 1 once the snapshot is complete and 0 while it isn't (or on failure)
+	int finish();					// Writes everything that is left, returns 1 on success
+	bool isWriting() const;
+	void clear();					// Drops the chunks and abandons an unfinished snapshot
+
+private:
+	struct PendingChunk {
+		SnapshotChunk info;
+		std::vector<unsigned char> bytes;
+	};
+	std::vector<PendingChunk> pending;
+	std::string finalPath, tempPath;
+	FILE* file = NULL;
+	size_t currentChunk = 0;		// Next chunk to write and how much of it is done
+	size_t currentOffset = 0;
+	uint64_t position = 0;			// Bytes in the file so far
+	uint64_t fileSize = 0;
+
+	int fail();						// Abandons the file and the chunks, always returns 0
+	int complete();					// Writes the header and renames the file
+};
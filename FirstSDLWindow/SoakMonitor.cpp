@@ -0,0 +1,143 @@
+#include "SoakMonitor.h"
+#include "Allocations.h"
+#include <algorithm>
+#include <cstdio>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#endif
+
+static const size_t GROWTH_RUNS = 4;				// Memory has to grow after this many runs in a row to be flagged
+static const size_t HEAP_GROWTH_SLACK = 64 << 10;	// and by more than this much over them (live heap between runs)
+static const size_t RESIDENT_GROWTH_SLACK = 4 << 20;	// or this much (resident set between runs of a mode)
+static const float DRIFT_FACTOR = 1.5f;				// A mode is too slow once its 95th percentile is this many times its first run's
+static const int DRIFT_RUNS = 2;					// for this many of its runs in a row
+
+size_t residentBytes() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return counters.WorkingSetSize;
+#else
+	FILE* file = fopen("/proc/self/statm", "r");
+	if (file == NULL) return 0;
+	unsigned long long size = 0, resident = 0;
+	int read = fscanf(file, "%llu %llu", &size, &resident);
+	fclose(file);
+	if (read != 2) return 0;
+	return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+SoakMonitor::SoakMonitor(double sampleSeconds) {
+	this->sampleSeconds = sampleSeconds;
+	start = std::chrono::steady_clock::now();
+	lastSample = start;
+	firstResident = residentBytes();
+	allocationsAtSample = allocationTotals().allocations;
+}
+
+void SoakMonitor::beginRun(int flags) {
+	this->flags = flags;
+	runTimes.clear();
+}
+
+void SoakMonitor::recordFrame(double ms) {
+	sampleTimes.push_back((float)ms);
+	runTimes.push_back((float)ms);
+	if (std::chrono::duration<double>(std::chrono::steady_clock::now() - lastSample).count() >= sampleSeconds) printSample();
+}
+
+void SoakMonitor::printSample() {
+	auto now = std::chrono::steady_clock::now();
+	double seconds = std::chrono::duration<double>(now - lastSample).count();
+	AllocationCounters totals = allocationTotals();
+	FrameTimes times = percentiles(sampleTimes);
+	printf("%8.0fs  mode %6d  rss %8.1f MB  heap %8.1f MB  %8.0f allocs/s  p50 %7.2f  p95 %7.2f  p99 %7.2f  max %7.2f ms\n",
+		std::chrono::duration<double>(now - start).count(), flags, residentBytes() / 1048576.0, totals.live / 1048576.0,
+		(totals.allocations - allocationsAtSample) / std::max(seconds, 1e-9), times.p50, times.p95, times.p99, times.worst);
+	sampleTimes.clear();
+	allocationsAtSample = totals.allocations;
+	lastSample = now;
+}
+
+void SoakMonitor::endRun() {
+	runs++;
+	FrameTimes times = percentiles(runTimes);
+	size_t resident = residentBytes();
+	int64_t heap = allocationTotals().live;
+	printf("Run %zu, mode %d: %zu frames, p50 %.2f  p95 %.2f  p99 %.2f  max %.2f ms, afterwards rss %.1f MB  heap %.1f MB\n",
+		runs, flags, runTimes.size(), times.p50, times.p95, times.p99, times.worst, resident / 1048576.0, heap / 1048576.0);
+
+	// Memory growth
+	heapAfter.push_back(heap);
+	std::vector<size_t> heapSizes(heapAfter.begin(), heapAfter.end());
+	if (!leak && keepsGrowing(heapSizes, HEAP_GROWTH_SLACK)) {
+		leak = true;
+		printf("Soak: the live heap grew after each of the last %zu runs, to %.1f MB, something outlives its game\n", GROWTH_RUNS, heap / 1048576.0);
+	}
+	ModeHistory& mode = modes[flags];
+	mode.residentAfter.push_back(resident);
+	if (!leak && keepsGrowing(mode.residentAfter, RESIDENT_GROWTH_SLACK)) {
+		leak = true;
+		printf("Soak: the resident set grew after each of the last %zu runs of mode %d, to %.1f MB\n", GROWTH_RUNS, flags, resident / 1048576.0);
+	}
+
+	// Latency drift
+	if (runTimes.empty()) return;
+	if (mode.firstP95 == 0) {
+		mode.firstP95 = times.p95;
+		return;
+	}
+	mode.slowRuns = (times.p95 > DRIFT_FACTOR * mode.firstP95) ? mode.slowRuns + 1 : 0;
+	if (!drift && mode.slowRuns >= DRIFT_RUNS) {
+		drift = true;
+		printf("Soak: mode %d slowed down, p95 %.2f ms against %.2f ms in its first run\n", flags, times.p95, mode.firstP95);
+	}
+}
+
+int SoakMonitor::hasLeak() const {
+	return leak;
+}
+
+int SoakMonitor::hasDrift() const {
+	return drift;
+}
+
+void SoakMonitor::printSummary() const {
+	printf("Soak Runtime:          %20.10f\n", std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	printf("Soak Runs:             %20.10zu\n", runs);
+	printf("Resident Set Growth:   %20.10f MB\n", ((double)residentBytes() - (double)firstResident) / 1048576.0);
+	if (!heapAfter.empty()) printf("Heap Between Runs:     %20.10f MB to %.10f MB\n", heapAfter.front() / 1048576.0, heapAfter.back() / 1048576.0);
+	printf("Memory Growth:         %20s\n", leak ? "flagged" : "none");
+	printf("Latency Drift:         %20s\n", drift ? "flagged" : "none");
+}
+
+SoakMonitor::FrameTimes SoakMonitor::percentiles(std::vector<float>& times) {
+	FrameTimes result;
+	if (times.empty()) return result;
+	auto at = [&](float fraction) {
+		auto nth = times.begin() + (size_t)(fraction * (times.size() - 1));
+		std::nth_element(times.begin(), nth, times.end());
+		return *nth;
+	};
+	result.p50 = at(0.5f);
+	result.p95 = at(0.95f);
+	result.p99 = at(0.99f);
+	result.worst = *std::max_element(times.begin(), times.end());
+	return result;
+}
+
+bool SoakMonitor::keepsGrowing(const std::vector<size_t>& values, size_t slack) {	// Over the last GROWTH_RUNS values, against the one before them
+	if (values.size() <= GROWTH_RUNS) return false;
+	size_t first = values.size() - GROWTH_RUNS - 1;
+	for (size_t i = first + 1; i < values.size(); i++) {
+		if (values[i] <= values[i - 1]) return false;
+	}
+	return values.back() - values[first] > slack;
+}
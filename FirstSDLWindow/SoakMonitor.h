@@ -0,0 +1,53 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+size_t residentBytes();		// Resident set of the process, 0 where it can't be read
+
+// Watches a long headless run of one game after another for leaks and slowdowns (see SOAK_HOURS in main.cpp)
+//	Every sampleSeconds it prints the resident set, the live heap and allocation rate (see Allocations.h) and frame time
+//	percentiles since the last sample. After every game it looks for two things and warns the first time either shows up:
+//	- Memory growth: a destroyed game should leave nothing behind, so the live heap between games should stay level, and so
+//	  should the resident set between games of the same mode. Growing run after run, by more than a little, is flagged.
+//	- Latency drift: each mode's 95th percentile frame time is held against the one from its first run, a mode that stays
+//	  clearly slower than that is flagged.
+class SoakMonitor {
+public:
+	explicit SoakMonitor(double sampleSeconds = 10);
+	void beginRun(int flags);					// Before a game with these flags is created
+	void recordFrame(double ms);				// Once a frame, with how long it took
+	void endRun();								// After the game was destroyed
+	int hasLeak() const;						// Returns 1 once memory growth was flagged
+	int hasDrift() const;						// Returns 1 once a mode was flagged as slowing down
+	void printSummary() const;
+
+private:
+	struct FrameTimes {							// In ms
+		float p50 = 0, p95 = 0, p99 = 0, worst = 0;
+	};
+	struct ModeHistory {
+		float firstP95 = 0;						// Of the mode's first run
+		int slowRuns = 0;						// Runs in a row that were too slow against it
+		std::vector<size_t> residentAfter;		// Resident set after each of the mode's runs
+	};
+
+	std::chrono::steady_clock::time_point start, lastSample;
+	double sampleSeconds;
+	int flags = 0;								// Of the current run
+	size_t runs = 0;
+	std::vector<float> sampleTimes;				// Frame times since the last sample
+	std::vector<float> runTimes;				// and since the run began
+	uint64_t allocationsAtSample = 0;
+	std::vector<int64_t> heapAfter;				// Live heap after each run
+	std::map<int, ModeHistory> modes;			// By flags
+	size_t firstResident = 0;
+	bool leak = false;
+	bool drift = false;
+
+	static FrameTimes percentiles(std::vector<float>& times);	// Reorders times
+	static bool keepsGrowing(const std::vector<size_t>& values, size_t slack);
+	void printSample();
+};
@@ -0,0 +1,147 @@
+#include "SpriteCache.h"
+#include <cmath>
+
+static const int ATLAS_SIZE = 512;
+static const int PADDING = 1;			// Empty pixels between sprites, nearest sampling never reaches a neighbour
+
+int SpriteCache::find(float radius, SDL_Rect& rect) {
+	if (lastSprite < sprites.size() && sprites[lastSprite].radius == radius) {
+		rect = sprites[lastSprite].rect;
+		return 1;
+	}
+	for (size_t i = 0; i < sprites.size(); i++) {
+		if (sprites[i].radius != radius) continue;
+		lastSprite = i;
+		rect = sprites[i].rect;
+		return 1;
+	}
+
+	// Shelf packing, sprites go left to right and a new shelf starts under the tallest sprite of the last one
+	int extent = 2 * (int)std::ceil(radius) + 1;
+	if (radius <= 0 || extent + PADDING > ATLAS_SIZE) return 0;
+	if (shelfX + extent + PADDING > ATLAS_SIZE) {
+		shelfX = 0;
+		shelfY += shelfHeight;
+		shelfHeight = 0;
+	}
+	if (shelfY + extent + PADDING > ATLAS_SIZE) return 0;
+	Sprite sprite;
+	sprite.radius = radius;
+	sprite.rect.x = shelfX;
+	sprite.rect.y = shelfY;
+	sprite.rect.w = extent;
+	sprite.rect.h = extent;
+	sprite.drawn = false;
+	shelfX += extent + PADDING;
+	if (extent + PADDING > shelfHeight) shelfHeight = extent + PADDING;
+	sprites.push_back(sprite);
+	lastSprite = sprites.size() - 1;
+	rect = sprite.rect;
+	return 1;
+}
+
+int SpriteCache::prepare(SDL_Renderer* renderer) {
+	if (unsupported) return 0;
+	if (atlas != NULL && owner != renderer) release();
+	bool cleared = true;
+	if (atlas == NULL) {
+		if (!SDL_RenderTargetSupported(renderer)) {
+			unsupported = true;
+			return 0;
+		}
+		atlas = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, ATLAS_SIZE, ATLAS_SIZE);
+		if (atlas == NULL) {
+			unsupported = true;
+			return 0;
+		}
+		SDL_SetTextureBlendMode(atlas, SDL_BLENDMODE_BLEND);
+		SDL_SetTextureScaleMode(atlas, SDL_ScaleModeNearest);	// Sprites are drawn at their own size, filtering would only blur them
+		owner = renderer;
+		cleared = false;
+		for (auto& sprite : sprites) {
+			sprite.drawn = false;
+		}
+	}
+
+	bool pending = !cleared;
+	for (auto& sprite : sprites) {
+		if (!sprite.drawn) pending = true;
+	}
+	if (!pending) return 1;
+
+	SDL_Texture* previous = SDL_GetRenderTarget(renderer);
+	SDL_SetRenderTarget(renderer, atlas);
+	if (!cleared) {
+		SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+		SDL_RenderClear(renderer);
+	}
+	SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+	for (auto& sprite : sprites) {
+		if (sprite.drawn) continue;
+		rasterize(sprite);
+		SDL_RenderDrawPoints(renderer, outline.data(), (int)outline.size());
+		sprite.drawn = true;
+	}
+	SDL_SetRenderTarget(renderer, previous);
+	return 1;
+}
+
+SDL_Texture* SpriteCache::texture() const {
+	return atlas;
+}
+
+int SpriteCache::size() const {
+	return ATLAS_SIZE;
+}
+
+int SpriteCache::center(const SDL_Rect& sprite) const {
+	return sprite.w / 2;
+}
+
+void SpriteCache::invalidate() {
+	release();
+}
+
+void SpriteCache::release() {
+	if (atlas != NULL) SDL_DestroyTexture(atlas);
+	atlas = NULL;
+	owner = NULL;
+}
+
+void SpriteCache::rasterize(const Sprite& sprite) {	// The same midpoint algorithm every circle used to be drawn with each frame
+	outline.clear();
+	int centreX = sprite.rect.x + center(sprite.rect);
+	int centreY = sprite.rect.y + center(sprite.rect);
+	const float diameter = (sprite.radius * 2);
+
+	float x = (sprite.radius - 1);
+	float y = 0;
+	float tx = 1;
+	float ty = 1;
+	float error = (tx - diameter);
+
+	while (x >= y)
+	{
+		//  Each of the following is a point in one octant of the circle
+		int offsets[8][2] = { { (int)x, -(int)y }, { (int)x, (int)y }, { -(int)x, -(int)y }, { -(int)x, (int)y },
+			{ (int)y, -(int)x }, { (int)y, (int)x }, { -(int)y, -(int)x }, { -(int)y, (int)x } };
+		for (auto& offset : offsets) {
+			SDL_Point point = { centreX + offset[0], centreY + offset[1] };
+			outline.push_back(point);
+		}
+
+		if (error <= 0)
+		{
+			++y;
+			error += ty;
+			ty += 2;
+		}
+
+		if (error > 0)
+		{
+			--x;
+			tx += 2;
+			error += (tx - diameter);
+		}
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "SDL.h"
+#include <cstdint>
+#include <vector>
+
+// Atlas texture of circle outlines, each radius is rasterized once and then drawn as a textured quad
+//	Sprites are white and get their color from the vertex colors (which modulate the texture), so one sprite covers every color.
+//	Sprites are packed into shelves of a single render target, a radius that doesn't fit anymore gets no sprite.
+//	The atlas belongs to the renderer, so release has to be called before the renderer is destroyed.
+class SpriteCache {
+public:
+	int find(float radius, SDL_Rect& sprite);	// Where the sprite for radius sits in the atlas (it is drawn on the next prepare), returns 0 if the atlas is full
+	int prepare(SDL_Renderer* renderer);	// Creates the atlas and draws the sprites asked for since the last prepare, returns 0 without render target support
+	SDL_Texture* texture() const;
+	int size() const;						// Width and height of the atlas in pixels
+	int center(const SDL_Rect& sprite) const;	// Offset from a sprite's top left corner to the circle's center
+	void invalidate();						// Render targets were lost (device reset), the atlas is made again on the next prepare
+	void release();							// Frees the atlas
+
+private:
+	struct Sprite {
+		float radius;
+		SDL_Rect rect;
+		bool drawn;
+	};
+	std::vector<Sprite> sprites;
+	size_t lastSprite = 0;					// Nearly every object has the same radius
+	SDL_Texture* atlas = NULL;
+	SDL_Renderer* owner = NULL;
+	bool unsupported = false;
+	int shelfX = 0, shelfY = 0, shelfHeight = 0;	// Next free spot on the current shelf
+	std::vector<SDL_Point> outline;
+
+	void rasterize(const Sprite& sprite);	// Midpoint circle outline into the sprite's rect
+};
@@ -0,0 +1,442 @@
+#include "StaticBVH.h"
+#include <algorithm>
+#include <limits>
+
+static const int SAH_BINS = 16;
+static const int MIN_LEAF_SIZE = 2;		// Leaves this small are never split
+static const int MAX_LEAF_SIZE = 8;		// Leaves this large are always split
+static const float TRAVERSAL_COST = 1.0f;	// Cost of visiting a node relative to testing one object
+static const int MAX_SAH_DEPTH = 32;	// Past this depth nodes are split at the median, which keeps the query stack bounded
+static const int MAX_INSERT_DEPTH = 56;	// Inserting deeper than this rebuilds the tree instead, the query stack holds 64
+static const int MAX_RESTORE_DEPTH = 64;	// Deepest saved tree restore takes over, counting the root as 1
+
+struct Bounds {
+	float minX = std::numeric_limits<float>::infinity();
+	float minY = std::numeric_limits<float>::infinity();
+	float maxX = -std::numeric_limits<float>::infinity();
+	float maxY = -std::numeric_limits<float>::infinity();
+
+	void grow(float x0, float y0, float x1, float y1) {
+		minX = std::min(minX, x0);
+		minY = std::min(minY, y0);
+		maxX = std::max(maxX, x1);
+		maxY = std::max(maxY, y1);
+	}
+	void grow(const Bounds& in) {
+		grow(in.minX, in.minY, in.maxX, in.maxY);
+	}
+	float perimeter() const {	// The 2D version of surface area
+		if (minX > maxX) return 0;
+		return 2 * ((maxX - minX) + (maxY - minY));
+	}
+};
+
+void StaticBVH::build(const std::vector<Object*>& objects) {
+	nodes.clear();
+	parents.clear();
+	items = objects;
+	objectCount = items.size();
+	root = -1;
+	if (items.empty()) return;
+	nodes.reserve(2 * items.size() / MIN_LEAF_SIZE + 1);
+	root = buildNode(0, (int)items.size(), 0);
+	parents.assign(nodes.size(), -1);
+	for (size_t i = 0; i < nodes.size(); i++) {
+		if (nodes[i].left == -1) continue;
+		parents[nodes[i].left] = (int)i;
+		parents[nodes[i].right] = (int)i;
+	}
+}
+
+int StaticBVH::buildNode(int first, int count, int depth) {
+	int index = (int)nodes.size();
+	nodes.push_back(Node());
+
+	// Bounds of the objects and of their centers
+	Bounds bounds, centers;
+	for (int i = first; i < first + count; i++) {
+		vector min = items[i]->AABB->min();
+		vector max = items[i]->AABB->max();
+		bounds.grow(min.x, min.y, max.x, max.y);
+		const vector* center = items[i]->AABB->center;
+		centers.grow(center->x, center->y, center->x, center->y);
+	}
+	nodes[index].minX = bounds.minX;
+	nodes[index].minY = bounds.minY;
+	nodes[index].maxX = bounds.maxX;
+	nodes[index].maxY = bounds.maxY;
+	nodes[index].left = -1;
+	nodes[index].right = -1;
+	nodes[index].first = first;
+	nodes[index].count = count;
+	if (count <= MIN_LEAF_SIZE) return index;
+
+	// Binned SAH: try SAH_BINS - 1 split planes on both axes and keep the cheapest one
+	float bestCost = std::numeric_limits<float>::infinity();
+	int bestAxis = -1;
+	int bestSplit = 0;
+	float parentPerimeter = bounds.perimeter();
+	for (int axis = 0; axis < 2 && depth < MAX_SAH_DEPTH; axis++) {
+		float lo = (axis == 0) ? centers.minX : centers.minY;
+		float hi = (axis == 0) ? centers.maxX : centers.maxY;
+		if (hi <= lo) continue;	// All centers on the same line, nothing to split on this axis
+		float scale = SAH_BINS / (hi - lo);
+
+		Bounds bins[SAH_BINS];
+		int binCounts[SAH_BINS] = {};
+		for (int i = first; i < first + count; i++) {
+			float c = (axis == 0) ? items[i]->AABB->center->x : items[i]->AABB->center->y;
+			int bin = std::min(SAH_BINS - 1, (int)((c - lo) * scale));
+			vector min = items[i]->AABB->min();
+			vector max = items[i]->AABB->max();
+			bins[bin].grow(min.x, min.y, max.x, max.y);
+			binCounts[bin]++;
+		}
+
+		// Sweeping from the right first so each split plane costs O(1)
+		float rightPerimeters[SAH_BINS];
+		int rightCounts[SAH_BINS];
+		Bounds right;
+		int rightCount = 0;
+		for (int b = SAH_BINS - 1; b > 0; b--) {
+			right.grow(bins[b]);
+			rightCount += binCounts[b];
+			rightPerimeters[b] = right.perimeter();
+			rightCounts[b] = rightCount;
+		}
+		Bounds left;
+		int leftCount = 0;
+		for (int b = 0; b < SAH_BINS - 1; b++) {	// Split between bin b and b + 1
+			left.grow(bins[b]);
+			leftCount += binCounts[b];
+			if (leftCount == 0 || rightCounts[b + 1] == 0) continue;
+			float cost = TRAVERSAL_COST + (left.perimeter() * leftCount + rightPerimeters[b + 1] * rightCounts[b + 1]) / parentPerimeter;
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = b;
+			}
+		}
+	}
+
+	int leftCount;
+	if (bestAxis == -1) {	// Too deep or every center is in the same spot, split at the median
+		if (count <= MAX_LEAF_SIZE) return index;
+		leftCount = count / 2;
+		bool alongX = (centers.maxX - centers.minX) >= (centers.maxY - centers.minY);
+		std::nth_element(items.begin() + first, items.begin() + first + leftCount, items.begin() + first + count, [&](const Object* a, const Object* b) {
+			return alongX ? (a->AABB->center->x < b->AABB->center->x) : (a->AABB->center->y < b->AABB->center->y);
+		});
+	}
+	else {
+		if (bestCost >= count && count <= MAX_LEAF_SIZE) return index;	// Testing every object is cheaper than splitting
+		float lo = (bestAxis == 0) ? centers.minX : centers.minY;
+		float hi = (bestAxis == 0) ? centers.maxX : centers.maxY;
+		float scale = SAH_BINS / (hi - lo);
+		auto middle = std::partition(items.begin() + first, items.begin() + first + count, [&](const Object* object) {
+			float c = (bestAxis == 0) ? object->AABB->center->x : object->AABB->center->y;
+			return std::min(SAH_BINS - 1, (int)((c - lo) * scale)) <= bestSplit;
+		});
+		leftCount = (int)(middle - (items.begin() + first));
+	}
+
+	int left = buildNode(first, leftCount, depth + 1);
+	int right = buildNode(first + leftCount, count - leftCount, depth + 1);
+	nodes[index].left = left;	// nodes may have been reallocated, so no references are kept across the recursion
+	nodes[index].right = right;
+	nodes[index].count = 0;
+	return index;
+}
+
+int StaticBVH::newLeaf(int first, int count) {
+	Node leaf;
+	leaf.left = -1;
+	leaf.right = -1;
+	leaf.first = first;
+	leaf.count = count;
+	nodes.push_back(leaf);
+	parents.push_back(-1);
+	return (int)nodes.size() - 1;
+}
+
+void StaticBVH::refit(int node) {
+	while (node != -1) {
+		Node& current = nodes[node];
+		Bounds bounds;
+		if (current.left == -1) {
+			for (int i = current.first; i < current.first + current.count; i++) {
+				vector min = items[i]->AABB->min();
+				vector max = items[i]->AABB->max();
+				bounds.grow(min.x, min.y, max.x, max.y);
+			}
+		}
+		else {
+			const Node& left = nodes[current.left];
+			const Node& right = nodes[current.right];
+			bounds.grow(left.minX, left.minY, left.maxX, left.maxY);
+			bounds.grow(right.minX, right.minY, right.maxX, right.maxY);
+		}
+		current.minX = bounds.minX;	// An empty leaf gets inverted bounds, which never overlap anything
+		current.minY = bounds.minY;
+		current.maxX = bounds.maxX;
+		current.maxY = bounds.maxY;
+		node = parents[node];
+	}
+}
+
+void StaticBVH::insert(Object* object) {
+	items.push_back(object);
+	objectCount++;
+	int leaf = newLeaf((int)items.size() - 1, 1);
+	if (root == -1) {
+		root = leaf;
+		refit(leaf);
+		return;
+	}
+
+	// Walking down to the sibling that grows the least (in perimeter) by taking the new object
+	vector min = object->AABB->min();
+	vector max = object->AABB->max();
+	int sibling = root;
+	int depth = 0;
+	while (nodes[sibling].left != -1) {
+		if (++depth > MAX_INSERT_DEPTH) {
+			rebuild();
+			return;
+		}
+		float growth[2];
+		int children[2] = { nodes[sibling].left, nodes[sibling].right };
+		for (int c = 0; c < 2; c++) {
+			const Node& child = nodes[children[c]];
+			Bounds before, after;
+			before.grow(child.minX, child.minY, child.maxX, child.maxY);
+			after.grow(before);
+			after.grow(min.x, min.y, max.x, max.y);
+			growth[c] = after.perimeter() - before.perimeter();
+		}
+		sibling = (growth[0] <= growth[1]) ? children[0] : children[1];
+	}
+
+	// The sibling and the new leaf get a new parent in the sibling's old spot
+	int oldParent = parents[sibling];
+	int parent = newLeaf(0, 0);
+	nodes[parent].left = sibling;
+	nodes[parent].right = leaf;
+	parents[parent] = oldParent;
+	parents[sibling] = parent;
+	parents[leaf] = parent;
+	if (oldParent == -1) {
+		root = parent;
+	}
+	else if (nodes[oldParent].left == sibling) {
+		nodes[oldParent].left = parent;
+	}
+	else {
+		nodes[oldParent].right = parent;
+	}
+	refit(leaf);
+}
+
+void StaticBVH::rebuild() {
+	std::vector<Object*> live;
+	live.reserve(objectCount);
+	for (auto& node : nodes) {
+		if (node.left != -1) continue;
+		live.insert(live.end(), items.begin() + node.first, items.begin() + node.first + node.count);
+	}
+	build(live);
+}
+
+int StaticBVH::remove(Object* object) {
+	if (root == -1) return 0;
+	const vector* center = object->AABB->center;
+	int stack[64];
+	int top = 0;
+	stack[top++] = root;
+	while (top > 0) {	// Only leaves whose bounds contain the object's center can hold it
+		int index = stack[--top];
+		Node& node = nodes[index];
+		if (node.maxX < center->x || node.minX > center->x || node.maxY < center->y || node.minY > center->y) continue;
+		if (node.left != -1) {
+			stack[top++] = node.right;
+			stack[top++] = node.left;
+			continue;
+		}
+		for (int i = node.first; i < node.first + node.count; i++) {
+			if (items[i] != object) continue;
+			items[i] = items[node.first + node.count - 1];	// Filling the hole with the last object of the leaf
+			items[node.first + node.count - 1] = NULL;
+			node.count--;
+			objectCount--;
+			refit(index);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void StaticBVH::query(const vector& min, const vector& max, std::vector<Object*>& found) const {
+	if (root == -1) return;
+	int stack[64];	// The tree is never anywhere near this deep
+	int top = 0;
+	stack[top++] = root;
+	while (top > 0) {
+		const Node& node = nodes[stack[--top]];
+		if (node.maxX < min.x || node.minX > max.x || node.maxY < min.y || node.minY > max.y) continue;
+		if (node.left == -1) {
+			for (int i = node.first; i < node.first + node.count; i++) {
+				vector itemMin = items[i]->AABB->min();
+				vector itemMax = items[i]->AABB->max();
+				if (itemMax.x < min.x || itemMin.x > max.x || itemMax.y < min.y || itemMin.y > max.y) continue;
+				found.push_back(items[i]);
+			}
+		}
+		else {
+			stack[top++] = node.right;
+			stack[top++] = node.left;
+		}
+	}
+}
+
+void StaticBVH::raycast(RaycastCollector& collector) const {
+	if (root == -1) return;
+	const Ray& ray = collector.ray;
+	float inverseX = safeInverse(ray.direction.x);
+	float inverseY = safeInverse(ray.direction.y);
+	int stack[64];
+	int top = 0;
+	stack[top++] = root;
+	while (top > 0 && !collector.done()) {
+		const Node& node = nodes[stack[--top]];
+		float entry;
+		if (!rayHitsBox(ray, inverseX, inverseY, collector.maxT(), node.minX, node.minY, node.maxX, node.maxY, entry)) continue;
+		if (node.left == -1) {
+			for (int i = node.first; i < node.first + node.count; i++) {
+				collector.test(items[i]);
+			}
+			continue;
+		}
+
+		// Visiting the nearer child first, so closest hit searches can cut the farther one off
+		const Node& left = nodes[node.left];
+		const Node& right = nodes[node.right];
+		float leftEntry, rightEntry;
+		int hitsLeft = rayHitsBox(ray, inverseX, inverseY, collector.maxT(), left.minX, left.minY, left.maxX, left.maxY, leftEntry);
+		int hitsRight = rayHitsBox(ray, inverseX, inverseY, collector.maxT(), right.minX, right.minY, right.maxX, right.maxY, rightEntry);
+		if (hitsLeft && hitsRight) {
+			if (leftEntry <= rightEntry) {
+				stack[top++] = node.right;
+				stack[top++] = node.left;
+			}
+			else {
+				stack[top++] = node.left;
+				stack[top++] = node.right;
+			}
+		}
+		else if (hitsLeft) {
+			stack[top++] = node.left;
+		}
+		else if (hitsRight) {
+			stack[top++] = node.right;
+		}
+	}
+}
+
+void StaticBVH::raycastPacket(const Ray* rays, RaycastCollector* const* collectors, int count) const {
+	if (root == -1) return;
+	RayPacket packet;
+	for (int lane = 0; lane < 4; lane++) {
+		if (lane < count) packet.set(lane, rays[lane], collectors[lane]->maxT());
+		else packet.set(lane, rays[0], -1);	// Unused lanes never hit
+	}
+
+	int stack[64];
+	int top = 0;
+	stack[top++] = root;
+	while (top > 0) {
+		const Node& node = nodes[stack[--top]];
+		int mask = packet.slabTest(node.minX, node.minY, node.maxX, node.maxY);
+		if (mask == 0) continue;	// No ray in the packet reaches this subtree
+		if (node.left != -1) {
+			stack[top++] = node.right;
+			stack[top++] = node.left;
+			continue;
+		}
+		for (int lane = 0; lane < count; lane++) {
+			if (!(mask & (1 << lane))) continue;
+			for (int i = node.first; i < node.first + node.count; i++) {
+				collectors[lane]->test(items[i]);
+			}
+			packet.maxT[lane] = collectors[lane]->done() ? -1 : collectors[lane]->maxT();	// Closer hits shrink the ray
+		}
+	}
+}
+
+size_t StaticBVH::size() const {
+	return objectCount;
+}
+
+const std::vector<StaticBVH::Node>& StaticBVH::getNodes() const {
+	return nodes;
+}
+
+const std::vector<Object*>& StaticBVH::getItems() const {
+	return items;
+}
+
+int StaticBVH::getRoot() const {
+	return root;
+}
+
+int StaticBVH::restore(const Node* savedNodes, size_t nodeCount, std::vector<Object*>& savedItems, int savedRoot, const std::vector<Object*>& objects) {
+	// Every node has to be reached exactly once from the root and no deeper than the query stacks go, and the leaves have to
+	// hold exactly the objects, anything else (a corrupt or made up snapshot) would crash or loop queries or miss objects
+	if (savedRoot < -1 || savedRoot >= (int)nodeCount) return 0;
+	std::vector<char> reached(nodeCount, 0);
+	std::vector<std::pair<int, int>> pending;	// Node and its depth
+	std::vector<Object*> held;
+	size_t reachedCount = 0;
+	if (savedRoot != -1) pending.emplace_back(savedRoot, 1);
+	while (!pending.empty()) {
+		int index = pending.back().first;
+		int depth = pending.back().second;
+		pending.pop_back();
+		if (reached[index] || depth > MAX_RESTORE_DEPTH) return 0;
+		reached[index] = 1;
+		reachedCount++;
+		const Node& node = savedNodes[index];
+		if (node.left == -1) {
+			if (node.first < 0 || node.count < 0 || (size_t)node.first + node.count > savedItems.size()) return 0;
+			for (int i = node.first; i < node.first + node.count; i++) {
+				if (savedItems[i] == NULL) return 0;
+				held.push_back(savedItems[i]);
+			}
+			continue;
+		}
+		if (node.left < 0 || node.right < 0 || node.left >= (int)nodeCount || node.right >= (int)nodeCount) return 0;
+		pending.emplace_back(node.right, depth + 1);
+		pending.emplace_back(node.left, depth + 1);
+	}
+	if (reachedCount != nodeCount || held.size() != objects.size()) return 0;
+	size_t slots = (size_t)std::count_if(savedItems.begin(), savedItems.end(), [](Object* item) { return item != NULL; });
+	if (slots != held.size()) return 0;	// Objects outside every leaf
+	std::vector<Object*> expected = objects;
+	std::sort(held.begin(), held.end());
+	std::sort(expected.begin(), expected.end());
+	if (held != expected) return 0;
+
+	nodes.assign(savedNodes, savedNodes + nodeCount);
+	items.swap(savedItems);
+	root = savedRoot;
+	objectCount = 0;
+	parents.assign(nodes.size(), -1);
+	for (size_t i = 0; i < nodes.size(); i++) {
+		if (nodes[i].left == -1) {
+			objectCount += nodes[i].count;
+			continue;
+		}
+		parents[nodes[i].left] = (int)i;
+		parents[nodes[i].right] = (int)i;
+	}
+	return 1;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include "Object.h"
+#include "Raycast.h"
+#include <vector>
+
+// Bounding volume hierarchy for objects that never move (walls, terrain, ...)
+//	It is built once with the surface area heuristic (perimeter in 2D), so building can be slow but queries are fast.
+//	Static objects only ever get queried by moving objects, so static-static pairs are never generated.
+class StaticBVH {
+public:
+	struct Node {
+		float minX, minY, maxX, maxY;
+		int left, right;	// Children (-1 for leaves)
+		int first, count;	// Objects in a leaf are items[first, first + count)
+	};
+
+	void build(const std::vector<Object*>& objects);	// Objects must already have their AABBs
+	void insert(Object* object);						// Adds one object without rebuilding, the tree gets worse the more is inserted
+	int remove(Object* object);							// Returns 1 if the object was in the tree
+	void query(const vector& min, const vector& max, std::vector<Object*>& found) const;	// Appends every object whose AABB overlaps [min, max]
+	void raycast(RaycastCollector& collector) const;	// Feeds the collector the objects along its ray, nearest nodes first
+	void raycastPacket(const Ray* rays, RaycastCollector* const* collectors, int count) const;	// The same for up to 4 rays at once, sharing one traversal
+	size_t size() const;
+
+	// Snapshots, so a saved tree can be used again without another SAH build
+	const std::vector<Node>& getNodes() const;
+	const std::vector<Object*>& getItems() const;		// Slots outside every leaf's range are NULL
+	int getRoot() const;
+	// Takes over a tree saved through the getters, savedItems is swapped in. Returns 0 and changes nothing if the tree isn't
+	// sound (every node reached once from the root, at most 64 deep) or its leaves don't hold exactly objects
+	int restore(const Node* savedNodes, size_t nodeCount, std::vector<Object*>& savedItems, int savedRoot, const std::vector<Object*>& objects);
+
+private:
+	std::vector<Node> nodes;
+	std::vector<Object*> items;	// Removed objects leave holes (NULL) at the end of their leaf's range
+	std::vector<int> parents;
+	int root = -1;
+	size_t objectCount = 0;
+
+	int buildNode(int first, int count, int depth);	// Returns the index of the new node
+	int newLeaf(int first, int count);
+	void refit(int node);							// Recomputes the bounds of node and all of its ancestors
+	void rebuild();									// SAH build over every object currently in the tree
+};
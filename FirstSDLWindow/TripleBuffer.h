@@ -0,0 +1,33 @@
+#pragma once
+#include <atomic>
+
+// Lock free hand over of the newest state from one producer thread to one consumer thread
+//	The producer fills writeBuffer and publishes it, the consumer picks up the newest published buffer when it is ready to.
+//	Neither side ever waits for the other: a buffer published before the consumer got to it is simply replaced by the next one.
+//	The buffers are reused forever, so types that keep their capacity (vectors) stop allocating once they are big enough.
+template <typename T>
+class TripleBuffer {
+public:
+	T& writeBuffer() {						// Producer only
+		return buffers[write];
+	}
+	void publish() {						// Producer only, the next writeBuffer is a different buffer
+		write = middle.exchange(write | FRESH, std::memory_order_acq_rel) & INDEX;
+	}
+	bool acquire() {						// Consumer only, returns false if nothing was published since the last acquire
+		if ((middle.load(std::memory_order_relaxed) & FRESH) == 0) return false;
+		read = middle.exchange(read, std::memory_order_acq_rel) & INDEX;
+		return true;
+	}
+	const T& readBuffer() const {			// Consumer only
+		return buffers[read];
+	}
+
+private:
+	static const int INDEX = 3;
+	static const int FRESH = 4;				// Set in middle when it holds a buffer the consumer hasn't seen
+	T buffers[3];
+	int write = 0;
+	std::atomic<int> middle{ 1 };
+	int read = 2;
+};
@@ -1,4 +1,7 @@
 #include "UniformGrid.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
 
 UniformGrid::UniformGrid() {}	// Do nothing
 
@@ -9,8 +12,9 @@ UniformGrid::UniformGrid(int cellWidth, int cellHeight, int windowWidth, int win
 	this->cellWidth = cellWidth;
 	this->cellHeight = cellHeight;
 
-	// Each Object* will begin as NULL and will already be 5 spots large for ease of pushing
-	uniformGrid = std::vector<std::vector<std::vector<Object*>>>(numXCells, std::vector<std::vector<Object*>>(numYCells, std::vector<Object*>(5, NULL)));
+	// Cells start out empty, objects are added as their fat boxes are made
+	uniformGrid = std::vector<std::vector<std::vector<Entry>>>(numXCells, std::vector<std::vector<Entry>>(numYCells));
+	occupiedSlot.assign(numXCells * numYCells, -1);
 	
 }
 
@@ -19,37 +23,224 @@ vector UniformGrid::getCell(const vector& pos)	// This does not error check if t
 	return vector((int)pos.x/cellWidth, (int)pos.y/cellHeight);
 }
 
-//setCells(Object* a)
-//	min = getCell(a.min)
-//	max = getCell(a.max)
-//	for (i = min.x; i <= max.x; i++)
-//		for (j = min.y; j <= max.y; j++)
-//			uniformGrid[i][j].gridArray.push_back(a)
-std::set<Object*> UniformGrid::setCellsAndScoutCollision(Object* a)	// Returns a set of to the objects that could be a collision. The set will be empty if there is nothing
-{
-	vector min = getCell(a->AABB->min());
-	vector max = getCell(a->AABB->max());
-	std::set<Object*> ret;
-	for (int i = (int)min.x; i <= (int)max.x; i++) {
-		if (i >= uniformGrid.size() || i < 0) continue;	// Skipping if i falls out of bounds
-		for (int j = (int)min.y; j <= (int)max.y; j++) {
-			if (j >= uniformGrid[i].size() || j < 0) continue;	// Skipping if j falls out of bounds
-			for (auto k = 0; k < uniformGrid[i][j].size(); k++) {	// Adding the objects that are already in the vector to the set of possible collisions
-				ret.insert(uniformGrid[i][j][k]);
+void UniformGrid::cellRange(const FatBox& box, int& minX, int& minY, int& maxX, int& maxY) const
+{
+	// Objects that left the grid are kept in the border cells, so they can still collide and be found by queries
+	int lastX = (int)uniformGrid.size() - 1;
+	int lastY = (int)uniformGrid[0].size() - 1;
+	minX = std::min(std::max((int)std::floor(box.minX / cellWidth), 0), lastX);
+	minY = std::min(std::max((int)std::floor(box.minY / cellHeight), 0), lastY);
+	maxX = std::min(std::max((int)std::floor(box.maxX / cellWidth), 0), lastX);
+	maxY = std::min(std::max((int)std::floor(box.maxY / cellHeight), 0), lastY);
+}
+
+void UniformGrid::addTo(int i, int j, const Entry& entry)
+{
+	std::vector<Entry>& cell = uniformGrid[i][j];
+	if (cell.empty()) {
+		int index = i * (int)uniformGrid[0].size() + j;
+		occupiedSlot[index] = (int)occupied.size();
+		occupied.push_back(index);
+	}
+	cell.push_back(entry);
+}
+
+void UniformGrid::removeFrom(int i, int j, Object* object)
+{
+	std::vector<Entry>& cell = uniformGrid[i][j];
+	auto found = std::find_if(cell.begin(), cell.end(), [object](const Entry& entry) { return entry.object == object; });
+	if (found == cell.end()) return;	// Never made it into this cell
+	cell.erase(found);	// Keeping the order, so pairs come out the same way every run
+	if (!cell.empty()) return;
+	int index = i * (int)uniformGrid[0].size() + j;	// Swapping the last occupied cell into this one's place
+	int slot = occupiedSlot[index];
+	occupied[slot] = occupied.back();
+	occupiedSlot[occupied[slot]] = slot;
+	occupied.pop_back();
+	occupiedSlot[index] = -1;
+}
+
+void UniformGrid::insert(Object* object, const FatBox& box)
+{
+	if (uniformGrid.empty() || box.isEmpty()) return;
+	int minX, minY, maxX, maxY;
+	cellRange(box, minX, minY, maxX, maxY);
+	Entry entry;
+	entry.object = object;
+	entry.box = box;
+	for (int i = minX; i <= maxX; i++) {
+		for (int j = minY; j <= maxY; j++) {
+			addTo(i, j, entry);
+		}
+	}
+}
+
+void UniformGrid::remove(Object* object, const FatBox& box)
+{
+	if (uniformGrid.empty() || box.isEmpty()) return;
+	int minX, minY, maxX, maxY;
+	cellRange(box, minX, minY, maxX, maxY);
+	for (int i = minX; i <= maxX; i++) {
+		for (int j = minY; j <= maxY; j++) {
+			removeFrom(i, j, object);
+		}
+	}
+}
+
+int UniformGrid::move(Object* object, const FatBox& from, const FatBox& to)
+{
+	if (uniformGrid.empty()) return 0;
+	if (from.isEmpty()) {
+		insert(object, to);
+		return 1;
+	}
+	int fromMinX, fromMinY, fromMaxX, fromMaxY, toMinX, toMinY, toMaxX, toMaxY;
+	cellRange(from, fromMinX, fromMinY, fromMaxX, fromMaxY);
+	cellRange(to, toMinX, toMinY, toMaxX, toMaxY);
+
+	// Cells it left lose the object, cells it stays in get the new box and cells it reached get a new entry
+	for (int i = fromMinX; i <= fromMaxX; i++) {
+		for (int j = fromMinY; j <= fromMaxY; j++) {
+			if (i < toMinX || i > toMaxX || j < toMinY || j > toMaxY) {
+				removeFrom(i, j, object);
+				continue;
+			}
+			for (auto& entry : uniformGrid[i][j]) {
+				if (entry.object == object) entry.box = to;
+			}
+		}
+	}
+	Entry entry;
+	entry.object = object;
+	entry.box = to;
+	int changed = 0;
+	for (int i = toMinX; i <= toMaxX; i++) {
+		for (int j = toMinY; j <= toMaxY; j++) {
+			if (i >= fromMinX && i <= fromMaxX && j >= fromMinY && j <= fromMaxY) continue;
+			addTo(i, j, entry);
+			changed = 1;
+		}
+	}
+	return changed || fromMinX != toMinX || fromMinY != toMinY || fromMaxX != toMaxX || fromMaxY != toMaxY;
+}
+
+std::pair<Object*, Object*>* UniformGrid::findPairs(FrameArena& arena, size_t& count) const
+{
+	// Counting first so the pairs can come out of the arena in one piece, every cell can at most pair up all of its entries
+	int rows = uniformGrid.empty() ? 0 : (int)uniformGrid[0].size();
+	size_t capacity = 0;
+	for (int index : occupied) {
+		size_t size = uniformGrid[index / rows][index % rows].size();
+		capacity += size * (size - 1) / 2;
+	}
+	std::pair<Object*, Object*>* pairs = arena.allocate<std::pair<Object*, Object*>>(capacity);
+	count = 0;
+	for (int index : occupied) {
+		int i = index / rows;
+		int j = index % rows;
+
+		// Boxes that share several cells are only paired in the one holding the corner where their overlap starts.
+		// Both boxes reach into this cell, so the corner can't be in a later one; it is in this one unless it lies
+		// before the cell's left or top edge (the first row and column also hold everything before the grid)
+		float left = (i == 0) ? -std::numeric_limits<float>::infinity() : (float)(i * cellWidth);
+		float top = (j == 0) ? -std::numeric_limits<float>::infinity() : (float)(j * cellHeight);
+		const std::vector<Entry>& cell = uniformGrid[i][j];
+		for (size_t a = 0; a < cell.size(); a++) {
+			const FatBox& box = cell[a].box;
+			for (size_t b = a + 1; b < cell.size(); b++) {
+				const FatBox& other = cell[b].box;
+				if (!box.overlaps(other)) continue;
+				if (std::max(box.minX, other.minX) < left || std::max(box.minY, other.minY) < top) continue;
+				pairs[count++] = std::make_pair(cell[a].object, cell[b].object);
 			}
-			uniformGrid[i][j].push_back(a);
 		}
 	}
-	return ret;
+	return pairs;
 }
 
 void UniformGrid::clearCells()
 {
-	for (auto i = 0; i < uniformGrid.size(); i++) {
-		for (auto j = 0; j < uniformGrid[i].size(); j++) {
-			uniformGrid[i][j].clear();
+	int rows = uniformGrid.empty() ? 0 : (int)uniformGrid[0].size();
+	for (int index : occupied) {
+		uniformGrid[index / rows][index % rows].clear();
+		occupiedSlot[index] = -1;
+	}
+	occupied.clear();
+}
+
+void UniformGrid::queryRegion(const vector& min, const vector& max, std::vector<Object*>& found) const
+{
+	if (uniformGrid.empty()) return;
+	int lastX = (int)uniformGrid.size() - 1;	// Clamped the same way as cellRange, objects outside the grid sit in the border cells
+	int lastY = (int)uniformGrid[0].size() - 1;
+	int minX = std::min(std::max((int)std::floor(min.x / cellWidth), 0), lastX);
+	int minY = std::min(std::max((int)std::floor(min.y / cellHeight), 0), lastY);
+	int maxX = std::min(std::max((int)std::floor(max.x / cellWidth), 0), lastX);
+	int maxY = std::min(std::max((int)std::floor(max.y / cellHeight), 0), lastY);
+	for (int i = minX; i <= maxX; i++) {
+		for (int j = minY; j <= maxY; j++) {
+			for (auto& entry : uniformGrid[i][j]) {
+				found.push_back(entry.object);
+			}
 		}
 	}
 }
 
+void UniformGrid::raycast(RaycastCollector& collector, float slack) const
+{
+	if (uniformGrid.empty()) return;
+	const Ray& ray = collector.ray;
+	int lastX = (int)uniformGrid.size() - 1;
+	int lastY = (int)uniformGrid[0].size() - 1;
+
+	// Objects can have moved up to slack since they were put in the cells, so every step also looks at a ring of neighbours
+	int ring = (int)std::ceil(slack / std::min(cellWidth, cellHeight));
 
+	// Clipping the ray to the grid plus a border, objects that left the grid are kept in the border cells
+	float border = (float)(ring + 2);
+	float inverseX = safeInverse(ray.direction.x);
+	float inverseY = safeInverse(ray.direction.y);
+	float t;
+	if (!rayHitsBox(ray, inverseX, inverseY, collector.maxT(), -border * cellWidth, -border * cellHeight,
+		(lastX + 1 + border) * cellWidth, (lastY + 1 + border) * cellHeight, t)) return;
+
+	// Amanatides & Woo traversal
+	float x = ray.origin.x + ray.direction.x * t;
+	float y = ray.origin.y + ray.direction.y * t;
+	int i = (int)std::floor(x / cellWidth);
+	int j = (int)std::floor(y / cellHeight);
+	int stepX = (inverseX > 0) ? 1 : -1;	// Signs come from the inverses so an axis aligned ray never steps backwards
+	int stepY = (inverseY > 0) ? 1 : -1;
+	float nextX = ((i + (stepX > 0)) * (float)cellWidth - ray.origin.x) * inverseX;	// t where the ray crosses into the next column
+	float nextY = ((j + (stepY > 0)) * (float)cellHeight - ray.origin.y) * inverseY;
+	float deltaX = std::abs(cellWidth * inverseX);
+	float deltaY = std::abs(cellHeight * inverseY);
+	int limit = (int)border;
+	while (t <= collector.maxT() && !collector.done()) {	// Any hit closer than t was already found in an earlier cell
+		if (i < -limit || j < -limit || i > lastX + limit || j > lastY + limit) break;
+		for (int a = std::max(i - ring, 0); a <= std::min(i + ring, lastX); a++) {
+			for (int b = std::max(j - ring, 0); b <= std::min(j + ring, lastY); b++) {
+				for (auto& entry : uniformGrid[a][b]) {
+					collector.test(entry.object);
+				}
+			}
+		}
+		if (i - ring > lastX || i + ring < 0 || j - ring > lastY || j + ring < 0) {	// Outside the grid everything is in the border cells
+			int a = std::min(std::max(i, 0), lastX);
+			int b = std::min(std::max(j, 0), lastY);
+			for (auto& entry : uniformGrid[a][b]) {
+				collector.test(entry.object);
+			}
+		}
+		if (nextX < nextY) {
+			t = nextX;
+			nextX += deltaX;
+			i += stepX;
+		}
+		else {
+			t = nextY;
+			nextY += deltaY;
+			j += stepY;
+		}
+	}
+}
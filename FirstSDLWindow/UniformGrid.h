@@ -1,18 +1,39 @@
 #pragma once
 #include "Object.h"
 #include <vector>
-#include <set>
+#include "FrameArena.h"
+#include "Raycast.h"
+#include <utility>
+
+// Objects stay in the cells their fat box (see FatBox in Object.h) touches from frame to frame, only objects whose fat box
+// was redone move, and usually not even to other cells. Each cell keeps the boxes next to its objects, so finding pairs
+// only reads the cells.
 class UniformGrid {
 public:
+	struct Entry {
+		Object* object;
+		FatBox box;
+	};
 	int cellWidth, cellHeight;
-	std::vector<std::vector<std::vector<Object*>>> uniformGrid;
+	std::vector<std::vector<std::vector<Entry>>> uniformGrid;
 	
 	UniformGrid();		// Default constructor for UniformGrid
 	UniformGrid(int cellWidth, int cellHeight, int windowWidth, int windowHeight);
 
 	vector getCell(const vector& pos);	// Returns a vector that has the x position and y position of the cell you're looking for
-	std::set<Object*> setCellsAndScoutCollision(Object* a);			// Sets all of the cells that the object a would be in
+	void insert(Object* object, const FatBox& box);
+	void remove(Object* object, const FatBox& box);		// box is the one object was inserted (or last moved) with
+	int move(Object* object, const FatBox& from, const FatBox& to);	// Returns 1 if the object changed cells, 0 if only its box changed
+	std::pair<Object*, Object*>* findPairs(FrameArena& arena, size_t& count) const;	// Every pair of overlapping boxes, once each. The array lives in arena until its next reset
 	void clearCells();					// Clears all of the cells in the uniformGrid.
+	void queryRegion(const vector& min, const vector& max, std::vector<Object*>& found) const;	// Appends everything in the cells touching [min, max] (objects in several cells show up more than once)
+	void raycast(RaycastCollector& collector, float slack) const;	// Walks the cells along the collector's ray (DDA), widened by slack, and feeds it their objects
 
+private:
+	void cellRange(const FatBox& box, int& minX, int& minY, int& maxX, int& maxY) const;	// Cells box touches, clamped to the grid
+	void addTo(int i, int j, const Entry& entry);
+	void removeFrom(int i, int j, Object* object);
+	std::vector<int> occupied;			// Cells holding anything (as i * rows + j), so findPairs and clearCells skip the empty ones
+	std::vector<int> occupiedSlot;		// Where each cell is in occupied (-1 while it is empty)
 };
 
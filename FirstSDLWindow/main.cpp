@@ -29,9 +29,19 @@
 
 #include <iostream>
 #include <vector>
+#include <chrono>
+#include <string>
 #include "Game.h"
+#include "SoakMonitor.h"
 
 #define RUN_BY_STEP false
+#define PIPELINED true			// Simulate on a second thread while this one renders (ignored when running by step)
+#define NUM_STATIC_OBJECTS 500	// Walls that never move, these go into the static BVH
+#define CAPTURE_PATH NULL		// Set to a file name to capture every CAPTURE_INTERVAL-th frame of each run as Y4M video (path_0.y4m, path_1.y4m, ...)
+#define CAPTURE_INTERVAL 2
+#define REPLAY_PATH NULL		// Set to a recording (see Game::startRecording) to replay it headless through every collision mode instead
+#define STRICT_REPLAY false		// Fails a replayed mode that allocates once it settled (see STRICT_ALLOCATIONS), which the uniform grid still does
+#define SOAK_HOURS 0			// Set above 0 to cycle headless through every collision mode for this long, watching for leaks and slowdowns (see SoakMonitor.h)
 
 // The main elements of a game loop are:
 	// Input	
@@ -68,9 +78,61 @@ int main(int args, char* argv[]) {
 	flags.push_back(SWEEP_AND_PRUNE_AABB | PRINT_METRICS | RENDER_COLLIDERS);
 	flags.push_back(VARIANCE_SWEEP_AND_PRUNE_AABB | PRINT_METRICS | RENDER_COLLIDERS);
 	flags.push_back(UNIFORM_GRID_AABB | PRINT_METRICS | RENDER_COLLIDERS);
+	flags.push_back(LINEAR_BVH_AABB | PRINT_METRICS | RENDER_COLLIDERS);
+	flags.push_back(NEIGHBOR_LIST_AABB | PRINT_METRICS | RENDER_COLLIDERS);
+	flags.push_back(ADAPTIVE_BROADPHASE | PRINT_METRICS | RENDER_COLLIDERS);
+
+	const char* replayPath = REPLAY_PATH;
+	if (replayPath != NULL) {	// The same recorded inputs through every mode, timed on the wall clock since the timesteps are the recorded ones
+		int failed = 0;
+		for (size_t i = 0; i < flags.size(); i++) {
+			Game game(1920, 1080, 0, (flags[i] & ~(PRINT_METRICS | RENDER_COLLIDERS)) | HEADLESS | (STRICT_REPLAY ? STRICT_ALLOCATIONS : 0));
+			if (!game.loadReplay(replayPath)) {
+				std::cout << "Couldn't load the replay " << replayPath << std::endl;
+				return 1;
+			}
+			auto start = std::chrono::steady_clock::now();
+			while (game.replayFrame()) {}	// To the end even after a strict failure, so every mode's time covers the whole replay
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			std::cout << "Flags " << flags[i] << ": " << elapsed.count() << " seconds";
+			if (game.getReplayMismatch() != 0) std::cout << " (diverged from the recording at frame " << game.getReplayMismatch() << ")";
+			if (game.getAllocationFailure() != 0) {
+				std::cout << " (failed, allocated at frame " << game.getAllocationFailure() << ")";
+				failed = 1;
+			}
+			std::cout << std::endl;
+		}
+		return failed;
+	}
+
+	if (SOAK_HOURS > 0) {	// Returns 1 if memory kept growing or a mode slowed down
+		SoakMonitor monitor;
+		auto end = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(SOAK_HOURS * 3600.0));
+		for (size_t i = 0; std::chrono::steady_clock::now() < end; i++) {
+			int soakFlags = (flags[i % flags.size()] & ~(PRINT_METRICS | RENDER_COLLIDERS)) | HEADLESS;
+			monitor.beginRun(soakFlags);
+			{
+				Game game(1920, 1080, 2500, soakFlags, NUM_STATIC_OBJECTS);
+				while (game.isRunning()) {
+					auto frameStart = std::chrono::steady_clock::now();
+					game.handleEvents();
+					game.update();
+					monitor.recordFrame(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count());
+				}
+			}
+			monitor.endRun();
+		}
+		monitor.printSummary();
+		return (monitor.hasLeak() || monitor.hasDrift()) ? 1 : 0;
+	}
 
 	for (size_t i = 0; true; i++) {
-		Game game(1920, 1080, 2500, flags[i % flags.size()]);
+		bool pipelined = PIPELINED && !RUN_BY_STEP;
+		Game game(1920, 1080, 2500, flags[i % flags.size()] | (pipelined ? PIPELINED_RENDER : 0), NUM_STATIC_OBJECTS);
+		const char* capturePath = CAPTURE_PATH;
+		if (capturePath != NULL && !game.startCapture((std::string(capturePath) + "_" + std::to_string(i) + ".y4m").c_str(), CAPTURE_Y4M, CAPTURE_INTERVAL)) {
+			std::cout << "Couldn't capture to " << capturePath << std::endl;
+		}
 		if (RUN_BY_STEP) {
 			std::cout << "Enter any key to continue simulation: ";
 			char q;
@@ -84,9 +146,8 @@ int main(int args, char* argv[]) {
 		else {
 			while (game.isRunning()) {
 				game.handleEvents();
-				game.update();
+				if (!pipelined) game.update();	// Otherwise the simulation thread is already updating
 				game.render();
-
 			}
 		}
 	}